@@ -0,0 +1,53 @@
+/* procmgr -- init-like process manager
+ * https://github.com/CylonicRaider/procmgr */
+
+/* Control group (v2) management
+ * Programs can be confined to a cgroup each, located (and named after the
+ * program) below a configured root directory; the root must be a cgroup v2
+ * directory the daemon may create subgroups in (i.e., the daemon runs as
+ * root, or the subtree has been delegated to the user it runs as), and the
+ * daemon must not be a member of it itself (as cgroups with controllers
+ * enabled for their children may not contain processes). Processes are
+ * placed into their cgroup when they are created (see launch.h). */
+
+#ifndef _CGROUP_H
+#define _CGROUP_H
+
+/* Default values of the limits (as written to the cgroup files) */
+#define CGROUP_MEMORY_MAX "max"
+#define CGROUP_WEIGHT 100
+
+/* Resource limits of a cgroup
+ * Members:
+ * memory_max: (char *) Value for memory.max (an amount of bytes with an
+ *             optional K, M, or G suffix, or "max"), or NULL for the
+ *             default.
+ * cpu_weight: (int) Value for cpu.weight (1 to 10000), or -1 for the
+ *             default.
+ * io_weight : (int) Default value for io.weight (1 to 10000), or -1 for
+ *             the default. */
+struct cglimits {
+    char *memory_max;
+    int cpu_weight;
+    int io_weight;
+};
+
+/* Ensure that the cgroup at path exists and has the given limits applied
+ * The controllers needed are enabled in the parent cgroup, if necessary;
+ * limits that are not specified are reset to their defaults (where the
+ * corresponding controller is enabled).
+ * Returns zero on success, or -1 on error (with errno set). */
+int cgroup_setup(char *path, struct cglimits *limits);
+
+/* Send the given signal to all processes in the cgroup at path
+ * SIGKILL is delivered using cgroup.kill where that is available.
+ * Returns the amount of processes signalled (or 1 if that is unknown), or
+ * -1 on error (with errno set). */
+int cgroup_signal(char *path, int sig);
+
+/* Validate a value for the memory_max member of struct cglimits
+ * Returns nonzero if value is valid, and zero (setting errno to EINVAL)
+ * otherwise. */
+int cgroup_check_memory(char *value);
+
+#endif
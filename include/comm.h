@@ -77,6 +77,20 @@ int comm_listen(struct config *conf);
  * See comm_listen() for return semantics. */
 int comm_connect(struct config *conf);
 
+/* Set up the socket for receiving readiness notifications
+ * The socket is bound to the notifypath member of conf (removing anything
+ * that was present there) and made non-blocking.
+ * See comm_listen() for return semantics. */
+int comm_listen_notify(struct config *conf);
+
+/* Receive a readiness notification
+ * The datagram is stored into buf (which has a capacity of size bytes) and
+ * NUL-terminated (being truncated if necessary); the PID of the sender is
+ * stored in pid (or -1 if it is unknown).
+ * Returns the length of the message, -2 if there is none, or -1 on error
+ * (with errno set). */
+int comm_recv_notify(int fd, char *buf, int size, int *pid);
+
 /* Receive a message from the communication socket
  * The fields member of msg is set to a dynamically allocated array
  * (free()ing the former value as well as all fields referenced from there if
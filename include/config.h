@@ -16,6 +16,20 @@
  *     default-suid = <default UID to switch to>
  *     default-sgid = <default GID to switch to>
  *     do-autostart = <autostart group to run>
+ *     spawn-helper = <yes or no>
+ *     cgroup-root = <cgroup v2 directory to create program cgroups in>
+ *     max-concurrent-starts = <amount of programs to start at once>
+ *     start-settle = <seconds after which a started program counts as up>
+ *     notify-socket = <readiness notification socket path>
+ *     status-page = <path of a file to publish the state of programs in>
+ *     shutdown-mode = <leave or stop>
+ *     shutdown-timeout = <seconds after which to kill all programs on exit>
+ *     rate-limit = <requests per second to admit from all clients together>
+ *     rate-burst = <requests to admit at once beyond rate-limit>
+ *     uid-rate-limit = <requests per second to admit from every UID>
+ *     uid-rate-burst = <requests to admit at once beyond uid-rate-limit>
+ *     max-inflight = <actions of all clients to be in progress at once>
+ *     uid-max-inflight = <actions of every UID to be in progress at once>
  *
  *     [prog-<name>]
  *     allow-uid = <default UID for all uid-* in this section>
@@ -27,25 +41,157 @@
  *     gid-<action> = <GID to allow to perform this action>
  *     suid-<action> = <UID to switch to when performing the action>
  *     sgid-<action> = <GID to switch to when performing the action>
+ *     shell-<action> = <yes, no, or auto>
  *     cwd = <directory to switch to before performing actions>
  *     restart-delay = <seconds after which approximately to restart>
+ *     restart-delay-max = <maximum seconds to back off restarts to>
+ *     restart-multiplier = <factor to increase the restart delay by>
+ *     restart-jitter = <fraction by which to vary the restart delay randomly>
+ *     restart-reset = <seconds of uptime after which to reset the delay>
+ *     restart-limit = <restarts per restart-window to quarantine beyond>
+ *     restart-window = <seconds over which restarts are counted>
  *     autostart = <yes, no, or integer autostart group>
+ *     cgroup = <yes or no>
+ *     memory-max = <memory limit in bytes (K, M, G suffixes allowed)>
+ *     cpu-weight = <relative CPU share, 1 to 10000>
+ *     io-weight = <relative I/O share, 1 to 10000>
+ *     cpus = <list of CPUs to run on, like 0-3,8>
+ *     nice = <nice value, -20 to 19>
+ *     ioprio = <realtime, best-effort, or idle[:<level from 0 to 7>]>
+ *     oom-score-adj = <OOM killer score adjustment, -1000 to 1000>
+ *     rlimit-<resource> = <limit, or soft and hard limit separated by a colon>
+ *     cpu-placement = <auto or none>
+ *     cpu-count = <amount of CPUs to place the program on>
+ *     start-priority = <integer; higher values start earlier>
+ *     requires = <whitespace-separated names of programs needed by this one>
+ *     after = <whitespace-separated names of programs to start before>
+ *     notify = <yes or no>
+ *     start-timeout = <seconds to wait for a notifying program to be ready>
+ *     stop-timeout = <seconds to wait for the program to stop before killing>
+ *     kill-mode = <process, group, or cgroup>
+ *     health-check = <exec <command>, connect <address>, or mtime <path>>
+ *     health-interval = <seconds between the starts of health checks>
+ *     health-timeout = <seconds after which a health check fails>
+ *     health-threshold = <consecutive failed health checks to restart after>
+ *     watchdog-interval = <seconds within which the program must ping>
+ *     status-cache-ms = <milliseconds to reuse the result of cmd-status for>
  *
  * For the UID and GID fields, and restart-delay, the special value "none"
  * (which is equal to -1) may be used, indicating that no UID/GID should be
  * allowed to perform an action or be changed to when performing it (thus
  * staying at the UID/GID the daemon itself had), or that the program should
  * not be automatically restarted (as it happens for every non-positive value
- * of restart-delay), respectively. cwd is only set at program level since an
- * individual command can change its directory itself. autostart tells
- * procmgr to automatically start a process (or not). The value "no" is
+ * of restart-delay), respectively. shell-* tells whether to run the command
+ * of the corresponding action using ACTION_SHELL (yes), to split it into
+ * words (honoring quotes and backslashes, but performing no expansions) and
+ * to execute it directly (no), or to do the latter if the command contains
+ * no shell metacharacters and names an executable file (auto, the
+ * default); a leading "exec" is skipped in the latter two cases, while
+ * commands whose "exec" has options always use the shell. cwd is
+ * only set at program level since an individual command can change its
+ * directory itself. autostart tells procmgr to automatically start a
+ * process (or not). The value "no" is
  * aliased to 0, which is a special autostart group that is not, in fact,
  * auto-started; "yes" is aliased to 1. Other autostart groups can be
  * specified as well, for example for an emergency or a maintenance profile.
  * The global do-autostart value specifies which autostart group to run (and
  * can be overridden using the corresponding command-line option); the
  * default is 1, so that programs with autostart=yes actually start
- * automatically.
+ * automatically. spawn-helper tells the daemon to delegate spawning
+ * processes to a helper process forked early on (see launch.h); it is only
+ * evaluated when the daemon starts. If cgroup-root is set, every program
+ * (save for those with cgroup=no) gets a cgroup named after it below that
+ * directory (see cgroup.h), in which the processes of its start and restart
+ * actions are created; memory-max, cpu-weight, and io-weight configure
+ * the corresponding cgroup limits (memory.max, cpu.weight, and the default
+ * io.weight); the cgroup is (re)configured whenever the program is started.
+ * cpus, nice, ioprio, oom-score-adj, and rlimit-* (where <resource> is one
+ * of the RLIMIT_* names from setrlimit(2) in lowercase, e.g. nofile; limits
+ * may be "infinity") are applied to the processes of the start and restart
+ * actions before they switch to their configured UID/GID (see struct
+ * procattr in launch.h); ioprio levels default to 4. cpu-placement=auto
+ * makes procmgr choose cpu-count (default 1) CPUs for the program itself
+ * (see cpumap.h), overriding cpus; the placement of all running programs
+ * is re-evaluated whenever such a program starts or stops.
+ * If max-concurrent-starts is positive, at most that many programs are
+ * starting at any time; further start (and restart) requests are queued and
+ * performed in order of descending start-priority (default 0) as earlier
+ * starts finish. A program is starting from its process being spawned until
+ * it has run for start-settle seconds (default 1) or exited. Autostarts are
+ * queued all at once, so that priorities apply among them as well.
+ * If restart-delay-max is greater than restart-delay, the delay before each
+ * automatic restart is multiplied by restart-multiplier (default 2) up to
+ * restart-delay-max, and reset to restart-delay once the program has run for
+ * restart-reset seconds (default 60); restart-jitter (between 0 and 1,
+ * default 0) varies every delay randomly by up to the given fraction. If
+ * restart-limit is positive and a program is restarted automatically more
+ * often than that within restart-window seconds (default 60), it is
+ * quarantined, i.e. not restarted anymore until it is started explicitly.
+ * A start of a program does not happen before all programs it requires or
+ * is to be started after that are starting have settled; programs that are
+ * required but not running are started along with it (and if a required
+ * program cannot be started, neither can the requiring one). The graph
+ * formed by requires and after must not contain cycles, and all programs
+ * named in requires must exist.
+ * Programs with notify=yes are passed the path of the notification socket
+ * (default: socket-path with ".notify" appended; the socket is only created
+ * once such a program, or one with a watchdog-interval, is configured, and
+ * its path is fixed from then on) in the NOTIFY_SOCKET environment
+ * variable, and are starting until they send a datagram containing the line
+ * "READY=1" to it (as with sd_notify(3); messages are accepted from the
+ * main process of the program and from other processes in its process
+ * group); start requests are only replied to then. If start-timeout is
+ * positive and the program is not ready after that many seconds, it is
+ * killed (and restarted).
+ * If status-page is set, the daemon publishes the state of all programs in
+ * a file at that path, which other processes can map into memory and read
+ * without talking to the daemon (see statuspage.h); like spawn-helper, it
+ * is only evaluated when the daemon starts.
+ * If shutdown-mode is stop (instead of the default leave), the daemon stops
+ * all programs when it is told to exit, and exits once they are gone:
+ * programs are stopped in parallel, except that a program is only stopped
+ * once no running program requires it or is to be started after it. If
+ * programs remain after shutdown-timeout seconds (default 30; 0 for no
+ * limit), they are killed; a second exit request does that immediately.
+ * The default stop action sends SIGTERM to the program; if the program has
+ * not exited after stop-timeout seconds (if positive), SIGKILL follows.
+ * kill-mode determines whether these signals are sent to the main process
+ * of the program only (process, the default), to its process group (group),
+ * or to all processes in its cgroup (cgroup; the same as group if the
+ * program has no cgroup).
+ * If health-check is set, the program is checked every health-interval
+ * seconds (default 10) while it is running and has settled, by running a
+ * shell command (exec; it must exit with status 0), by connecting to a
+ * TCP port or UNIX domain socket (connect; the address is an absolute path,
+ * a port, or a numerical host address and a port separated by a colon, with
+ * IPv6 addresses in brackets), or by looking at the modification time of a
+ * file (mtime; it must not be older than health-timeout seconds). Commands
+ * run with the UID, GID, and working directory of the start action, and an
+ * environment like that of actions (without ACTION). Checks not finished
+ * after health-timeout seconds (default 5) fail; after health-threshold
+ * (default 3) consecutive failures, the program is restarted.
+ * If watchdog-interval is positive, the program is passed NOTIFY_SOCKET (as
+ * with notify=yes) and that interval in microseconds in the WATCHDOG_USEC
+ * environment variable, and must send a datagram containing the line
+ * "WATCHDOG=1" to the notification socket at least once per interval
+ * (counted from its start or its latest such message); otherwise, it is
+ * restarted.
+ * If status-cache-ms is positive, the standard output of cmd-status is
+ * captured (up to STATUS_OUTPUT_MAX bytes) and relayed to the client in the
+ * reply; status requests arriving while the command runs, or less than
+ * that many milliseconds after it finished, receive the same output and
+ * exit status instead of running the command again. Status requests with
+ * arguments are neither captured nor coalesced.
+ * If rate-limit is positive, RUN requests are admitted at that rate (on
+ * average) from all clients together, with up to rate-burst (default: the
+ * rate, but at least 1) at once; uid-rate-limit and uid-rate-burst
+ * do the same for every UID separately. If max-inflight is positive, RUN
+ * requests are rejected while that many actions performed on behalf of
+ * clients are in progress (i.e. queued, waiting for the spawn helper, or
+ * spawned and not replied to yet); uid-max-inflight does the same for every
+ * UID separately. Requests beyond any of these limits are rejected with the
+ * error code EBUSY before being looked at any further; requests from UID 0 are always admitted (although
+ * actions in progress on their behalf count towards max-inflight).
  * Arbitrarily many program sections can be specified; out of same-named
  * ones, only the last is considered; similarly for all values. Spacing
  * between sections is purely decorational, although it increases legibility.
@@ -74,8 +220,16 @@
 #ifndef _CONFIG_H
 #define _CONFIG_H
 
+#include "cgroup.h"
 #include "conffile.h"
+#include "cpumap.h"
+#include "health.h"
 #include "jobs.h"
+#include "launch.h"
+#include "statuspage.h"
+
+/* Maximum length of the output of a status command that is cached */
+#define STATUS_OUTPUT_MAX 4096
 
 /* Default location of communication socket. */
 #define SOCKET_PATH "/var/run/procmgr"
@@ -88,6 +242,47 @@
 #define PROG_RUNNING 1
 /* (Internal) The program is marked for removal. */
 #define PROG_REMOVE 2
+/* The placed member of the program is valid. */
+#define PROG_PLACED 4
+/* The program has been started recently and is not settled yet. */
+#define PROG_STARTING 8
+/* A start of the program is waiting for its turn. */
+#define PROG_QUEUED 16
+/* (Internal) Used while checking for dependency cycles. */
+#define PROG_VISITING 32
+#define PROG_VISITED 64
+/* The program has been killed for not becoming ready in time, and is to be
+ * restarted. */
+#define PROG_TIMEDOUT 128
+/* The program has been restarted too often and is not restarted
+ * automatically anymore. */
+#define PROG_QUARANTINED 256
+/* The program is being stopped because the daemon is shutting down. */
+#define PROG_STOPPING 512
+/* The main process of the program has been submitted to the spawner, and
+ * its PID is not known yet. */
+#define PROG_SPAWNING 1024
+
+/* The flags whose changes count as changes of the state of a program */
+#define PROG_TRACKED (PROG_REMOVE | PROG_PLACED | PROG_STARTING | \
+                      PROG_QUEUED | PROG_QUARANTINED | PROG_SPAWNING)
+
+/* Maximum amount of removed programs to remember for listings */
+#define TOMBSTONE_MAX 1024
+
+/* Values of the shell member of struct action */
+#define SHELL_NEVER 0  /* Always run the command directly */
+#define SHELL_ALWAYS 1 /* Always run the command using ACTION_SHELL */
+#define SHELL_AUTO 2   /* Run the command directly if possible */
+
+/* Values of the shutdownmode member of struct config */
+#define SHUTDOWN_LEAVE 0 /* Leave programs running when exiting */
+#define SHUTDOWN_STOP 1  /* Stop all programs before exiting */
+
+/* Values of the killmode member of struct program */
+#define KILL_PROCESS 0 /* Signal the main process only */
+#define KILL_GROUP 1   /* Signal the process group of the main process */
+#define KILL_CGROUP 2  /* Signal all processes in the cgroup */
 
 /* Shell to invoke actions with. */
 #define ACTION_SHELL "/bin/sh"
@@ -97,34 +292,168 @@
 struct program;
 struct action;
 
+/* Token bucket limiting the rate at which requests are admitted
+ * Members:
+ * uid   : (int) The UID the bucket applies to, or -1 for all of them.
+ * tokens: (double) The amount of requests that may be admitted right now.
+ * stamp : (double) The timestamp at which tokens has been updated last.
+ * next  : (struct bucket *) Linked list interconnection. */
+struct bucket {
+    int uid;
+    double tokens;
+    double stamp;
+    struct bucket *next;
+};
+
+/* Amount of actions in progress on behalf of a single UID
+ * Members:
+ * uid  : (int) The UID.
+ * count: (int) The amount of actions.
+ * next : (struct uidcount *) Linked list interconnection. */
+struct uidcount {
+    int uid;
+    int count;
+    struct uidcount *next;
+};
+
+/* Record of a program that has been removed, for listings of changes
+ * Members:
+ * name: (char *) The name of the program.
+ * gen : (unsigned long long) The generation at which it has been removed.
+ * next: (struct tombstone *) Linked list interconnection; the list is
+ *       ordered from the newest to the oldest entry. */
+struct tombstone {
+    char *name;
+    unsigned long long gen;
+    struct tombstone *next;
+};
+
 /* Root configuration structure
  * Members:
  * socketpath: (char *) The filesystem path of the communication socket.
  *             Defaults to SOCKET_PATH.
  * socket    : (int) The (UNIX domain) socket to use for communications.
  *             Bound to by the daemon, connected to by the clients.
+ * notifypath: (char *) The filesystem path of the notification socket.
+ *             Not changed anymore once the socket is open.
+ * notify    : (int) The socket readiness notifications are received on by
+ *             the daemon, or -1 if none.
+ * statuspath: (char *) The path of the status page, or NULL if none. Not
+ *             changed anymore once the page is open.
+ * statuspage: (struct statuspage *) The status page published by the
+ *             daemon, or NULL if none.
  * flags     : (int) Bitmask of CONFIG_* constants.
  * def_uid   : (int) The default value for allow_uid in actions.
  * def_gid   : (int) The default value for allow_gid in actions.
  * def_suid  : (int) The default value for suid in actions.
  * def_sgid  : (int) The default value for sgid in actions.
  * autostart : (int) The effective autostart group.
+ * spawnhelper: (int) Whether to use a spawner process (see launch.h).
+ * spawner   : (int) The socket connected to the spawner process, or -1 if
+ *             none.
+ * spawns    : (struct jobqueue *) The launches submitted to the spawner
+ *             whose outcome is not known yet, in submission order (see
+ *             handle_spawns()).
+ * cgrouproot: (char *) The directory to create program cgroups in, or NULL
+ *             if none.
  * conffile  : (struct conffile *) The configuration file underlying this
  *             configuration. May be NULL.
  * jobs      : (struct jobqueue *) The queue of pending jobs.
+ * execs     : (struct execfile *) Cache of executables (see launch.h).
+ *             Flushed whenever the configuration is reloaded.
+ * cpumap    : (struct cpumap *) The CPU topology, or NULL if not read yet
+ *             (this happens when a program is placed for the first time).
+ * maxstarts : (int) The maximum amount of programs starting at once, or 0
+ *             for no limit.
+ * settle    : (int) The time (in seconds) after which a started program is
+ *             not considered starting anymore.
+ * starting  : (int) The amount of programs currently starting.
+ * holdstarts: (int) Whether to queue all starts regardless of maxstarts.
+ * starts    : (struct jobqueue *) The queue of pending starts, ordered by
+ *             descending priority.
+ * shutdownmode: (int) What to do with the programs when exiting (one of the
+ *             SHUTDOWN_* constants).
+ * shutdowntimeout: (int) The time (in seconds) after which to kill the
+ *             programs remaining when shutting down, or 0 for no limit.
+ * shutdown  : (double) The timestamp at which shutting down started, or 0
+ *             if the daemon is not shutting down.
+ * deadline  : (double) The timestamp at which to kill all programs left
+ *             while shutting down.
+ * killed    : (int) Whether that has happened already.
+ * ratelimit : (double) The rate (in requests per second) at which requests
+ *             are admitted in total, or 0 for no limit.
+ * rateburst : (double) The capacity of ratebucket, or 0 for the default.
+ * uidratelimit: (double) Like ratelimit, but for every UID.
+ * uidrateburst: (double) Like rateburst, for the entries of buckets.
+ * maxinflight: (int) The maximum amount of actions in progress on behalf
+ *             of clients, or 0 for no limit.
+ * uidmaxinflight: (int) Like maxinflight, but for every UID.
+ * ratebucket: (struct bucket) The token bucket of all requests.
+ * buckets   : (struct bucket *) A linked list of the token buckets of
+ *             individual UIDs; full buckets are discarded.
+ * inflight  : (int) The amount of actions in progress on behalf of clients
+ *             (i.e. queued, or spawned and not replied to yet).
+ * uidinflight: (struct uidcount *) A linked list of the amounts of such
+ *             actions of individual UIDs; entries dropping to zero are
+ *             discarded.
+ * generation: (unsigned long long) Incremented whenever the state of
+ *             programs is found to have changed (see config_track()).
+ *             Starts at the time the configuration is created in
+ *             milliseconds, so that generations of an earlier instance of
+ *             the daemon are (most likely) older than horizon.
+ * horizon   : (unsigned long long) The oldest generation from which on
+ *             all changes can be told; increases as tombstones are
+ *             discarded.
+ * tombstones: (struct tombstone *) A linked list of programs removed from
+ *             the configuration, with at most TOMBSTONE_MAX entries.
+ * tombcount : (int) The length of that list.
  * programs  : (struct program *) A linked list of the programs configured
  *             and/or used. */
 struct config {
     char *socketpath;
     int socket;
+    char *notifypath;
+    int notify;
+    char *statuspath;
+    struct statuspage *statuspage;
     int flags;
     int def_uid;
     int def_gid;
     int def_suid;
     int def_sgid;
     int autostart;
+    int spawnhelper;
+    int spawner;
+    struct jobqueue *spawns;
+    char *cgrouproot;
     struct conffile *conffile;
     struct jobqueue *jobs;
+    struct execfile *execs;
+    struct cpumap *cpumap;
+    int maxstarts;
+    int settle;
+    int starting;
+    int holdstarts;
+    struct jobqueue *starts;
+    int shutdownmode;
+    int shutdowntimeout;
+    double shutdown;
+    double deadline;
+    int killed;
+    double ratelimit;
+    double rateburst;
+    double uidratelimit;
+    double uidrateburst;
+    int maxinflight;
+    int uidmaxinflight;
+    struct bucket ratebucket;
+    struct bucket *buckets;
+    int inflight;
+    struct uidcount *uidinflight;
+    unsigned long long generation;
+    unsigned long long horizon;
+    struct tombstone *tombstones;
+    int tombcount;
     struct program *programs;
 };
 
@@ -138,11 +467,81 @@ struct config {
  *              or -1 if none.
  * flags      : (int) Flags. See the PROG_* constants for descriptions.
  * delay      : (int) Restart delay in seconds.
+ * delaymax   : (int) The maximum restart delay to back off to; backoff is
+ *              disabled if this is not greater than delay.
+ * multiplier : (double) The factor to increase the restart delay by after
+ *              each restart.
+ * jitter     : (double) The fraction by which to vary restart delays
+ *              randomly (0 to 1).
+ * stable     : (int) The uptime (in seconds) after which the restart delay
+ *              is reset.
+ * limit      : (int) The amount of automatic restarts within window beyond
+ *              which the program is quarantined, or 0 for no limit.
+ * window     : (int) The length (in seconds) of the interval restarts are
+ *              counted in.
+ * curdelay   : (double) The current restart delay (without jitter), or 0
+ *              if the program has not been restarted recently.
+ * started    : (double) The timestamp of the latest start of the program.
+ * winstart   : (double) The timestamp at which the current restart counting
+ *              interval started.
+ * restarts   : (int) The amount of automatic restarts in that interval.
+ * restartcount: (int) The total amount of automatic restarts.
+ * exitcode   : (int) The exit status of the latest process of the program
+ *              (negative signal numbers for processes killed by signals);
+ *              only valid if exited is nonzero.
+ * exited     : (double) The timestamp at which the latest process of the
+ *              program exited, or 0 if none has yet.
  * autostart  : (int) Autostart group. 0 is "no autostart" (the default for
  *              a configuration entry), 1 is the "standard" one (selected by
  *              the server as default); must be nonnegative.
  * cwd        : (char *) Working directory to start actions in (unspecified
  *              if NULL).
+ * cgroup     : (char *) The cgroup to run the program in, or NULL if none.
+ * limits     : (struct cglimits) Resource limits to apply to cgroup.
+ * attr       : (struct procattr *) Scheduling attributes and resource
+ *              limits of the program, or NULL if none are configured.
+ * cpucount   : (int) The amount of CPUs to place the program on
+ *              automatically, or 0 not to do that.
+ * placed     : (cpu_set_t) The CPUs the program has been placed on; only
+ *              valid if the PROG_PLACED flag is set.
+ * priority   : (int) The start priority; queued starts of programs with
+ *              higher priorities are performed first.
+ * startgen   : (int) Incremented whenever the program is started, to tell
+ *              apart consecutive starts.
+ * changed    : (unsigned long long) The generation (see struct config) at
+ *              which the state of the program has been found to change
+ *              last.
+ * seenpid    : (int) The PID the program had when its state was last
+ *              examined by config_track().
+ * seenflags  : (int) The flags (out of PROG_TRACKED) at that time.
+ * seenplaced : (cpu_set_t) The placement at that time (only valid if
+ *              seenflags contains PROG_PLACED).
+ * requires   : (char **) Names of programs that must be running for this
+ *              one to start, as a NULL-terminated array. May be NULL.
+ * after      : (char **) Names of programs that must have settled (if they
+ *              are starting) for this one to start. May be NULL.
+ * notify     : (int) Whether the program reports its readiness via the
+ *              notification socket.
+ * timeout    : (int) The time (in seconds) to wait for the program to become
+ *              ready before killing it, or 0 for no limit.
+ * stoptimeout: (int) The time (in seconds) to wait for the program to exit
+ *              after SIGTERM before sending SIGKILL, or 0 for no limit.
+ * killmode   : (int) Which processes to signal when stopping the program
+ *              (one of the KILL_* constants).
+ * stopped    : (double) The timestamp at which the program has been told to
+ *              stop during shutdown (only valid if PROG_STOPPING is set).
+ * health     : (struct healthcheck *) The health check of the program, or
+ *              NULL if none.
+ * hstate     : (struct healthstate) The state of health checking.
+ * watchdog   : (int) The time (in seconds) within which the program must
+ *              send a keepalive message, or 0 if it need not.
+ * wdeadline  : (double) The timestamp by which the next keepalive message
+ *              is due.
+ * statuscache: (int) The time (in milliseconds) for which the result of
+ *              act_status (when run without arguments) is reused, or 0 not
+ *              to capture it.
+ * statusrun  : (struct statusrun *) The latest execution of act_status if
+ *              statuscache is positive, or NULL.
  * prev, next : (struct program *) Linked list interconnection.
  * act_start  : (struct action *) The action to start the program. If not
  *              configured, starting fails. The PID of the process started
@@ -158,18 +557,56 @@ struct config {
  * act_stop   : (struct action *) The action to stop the program. If not
  *              configured, the process is killed using SIGTERM.
  * act_status : (struct action *) The action to check program status. If not
- *              configured, "running" is printed to stdout (with a trailing
- *              newline) while checking status and 0 is returned if the
- *              program is running; otherwise, "not running" is printed (with
- *              a trailing newline as well), and 1 is returned. */
+ *              configured, the daemon replies directly (without spawning a
+ *              process) with 0 if the program is running and 1 otherwise,
+ *              followed by key=value fields describing the program (see
+ *              request_run() in control.h); the client prints "running" or
+ *              "not running" (with a trailing newline) accordingly. */
 struct program {
     char *name;
     int refcount;
     int pid;
     int flags;
     int delay;
+    int delaymax;
+    double multiplier;
+    double jitter;
+    int stable;
+    int limit;
+    int window;
+    double curdelay;
+    double started;
+    double winstart;
+    int restarts;
+    int restartcount;
+    int exitcode;
+    double exited;
     int autostart;
     char *cwd;
+    char *cgroup;
+    struct cglimits limits;
+    struct procattr *attr;
+    int cpucount;
+    cpu_set_t placed;
+    int priority;
+    int startgen;
+    unsigned long long changed;
+    int seenpid;
+    int seenflags;
+    cpu_set_t seenplaced;
+    char **requires;
+    char **after;
+    int notify;
+    int timeout;
+    int stoptimeout;
+    int killmode;
+    double stopped;
+    struct healthcheck *health;
+    struct healthstate hstate;
+    int watchdog;
+    double wdeadline;
+    int statuscache;
+    struct statusrun *statusrun;
     struct program *prev, *next;
     struct action *act_start;
     struct action *act_restart;
@@ -181,7 +618,10 @@ struct program {
 
 /* Possible action to be performed on a program
  * The command is run by ACTION_SHELL, appended after a "-c" parameter;
- * additional positional arguments are passed after it. The execution
+ * additional positional arguments are passed after it. If the command is
+ * run directly instead (see the shell member), additional arguments are
+ * appended to its words for SHELL_NEVER, and ignored for SHELL_AUTO (as the
+ * shell would have ignored them as well). The execution
  * environment is empty, save for the following variables:
  * PATH     -- The path to get executables from. All other ones must be
  *             fetched by absolute path. Equal to the ACTION_PATH constant.
@@ -208,6 +648,20 @@ struct program {
  *            affect default actions.
  * sgid     : (int) GID to switch to when performing this action, similar
  *            to suid.
+ * shell    : (int) Whether to run command using ACTION_SHELL; one of the
+ *            SHELL_* constants.
+ * execpath : (char *) The executable to run (ACTION_SHELL or the first word
+ *            of command), or NULL if there is no command.
+ * execargv : (char **) The static part of the argument vector (the words of
+ *            command with a leading "exec" removed, or ACTION_SHELL, "-c",
+ *            and command), or NULL if there is no command.
+ * execargc : (int) The length of execargv.
+ * passargs : (int) Whether to append additional arguments to execargv.
+ * execenvp : (char **) The environment to run command in, or NULL if there
+ *            is no command. The entry at envpid is reserved for the PID
+ *            variable, and filled in when the action is performed.
+ * envpid   : (int) The index of the PID variable in execenvp.
+ * execargv and execenvp are assembled when the configuration is loaded.
  */
 struct action {
     char *name;
@@ -216,6 +670,34 @@ struct action {
     int allow_gid;
     int suid;
     int sgid;
+    int shell;
+    char *execpath;
+    char **execargv;
+    int execargc;
+    int passargs;
+    char **execenvp;
+    int envpid;
+};
+
+/* Captured execution of a status command
+ * Members:
+ * refcount: (int) The amount of references to this structure. Use
+ *           statusrun_del() to deal with decreasing.
+ * pid     : (int) The PID of the command while it is running, or -1.
+ * fd      : (int) A memory file capturing the output of the command until
+ *           it is collected, or -1.
+ * finished: (double) The timestamp at which the command finished, or 0 if
+ *           it has not yet.
+ * code    : (int) The exit status of the command, if it has finished.
+ * output  : (char *) The (NUL-terminated) output of the command, if it has
+ *           finished. */
+struct statusrun {
+    int refcount;
+    int pid;
+    int fd;
+    double finished;
+    int code;
+    char *output;
 };
 
 /* Create a new runtime configuration based on the given configuration file
@@ -241,7 +723,9 @@ void config_free(struct config *conf);
  * Programs that have vanished from the file and are not running are removed;
  * such ones that still are running persist until they are stopped; programs
  * whose configuration values have changed retain their runtime data; new
- * programs are added to the configuration, and not started.
+ * programs are added to the configuration, and not started. If any of the
+ * new programs cannot be created, or their dependencies are invalid, the
+ * programs are left as they were (global settings are updated regardless).
  * Returns the amount of programs affected on success (removed ones count
  * positively), or -1 on fatal or -2 on non-fatal error with errno set,
  * having written a message to stderr first (if quiet is true). */
@@ -258,9 +742,18 @@ struct program *config_get(struct config *conf, char *name);
  * A PID of -1 returns NULL. */
 struct program *config_getpid(struct config *conf, int pid);
 
-/* Remove the given program from the configuration, deallocating it */
+/* Remove the given program from the configuration, deallocating it
+ * The program is unlinked from the list immediately, even if other
+ * references to it remain (which keep it allocated); it must not be passed
+ * to this function again. A tombstone is left for listings of changes. */
 void config_remove(struct config *conf, struct program *prog);
 
+/* Note which programs have changed their state since the last call
+ * The generation is incremented (once) if any have, and assigned to their
+ * changed members. New programs count as changed.
+ * Returns the current generation. */
+unsigned long long config_track(struct config *conf);
+
 /* Allocate a program using the configuration from the given configuration
  * object and configuration section (none, any, or both can be NULL)
  * The reference count of the program is initially 1. */
@@ -279,4 +772,20 @@ void prog_free(struct program *prog);
 /* Return the action named by name from prog, or NULL if none */
 struct action *prog_action(struct program *prog, char *name);
 
+/* Allocate a status command execution with a fresh memory file
+ * The reference count is initially 1.
+ * Returns the new structure, or NULL on error (with errno set). */
+struct statusrun *statusrun_new(void);
+
+/* Free all the resources underlying the given structure
+ * If the reference count is more than 1, it is merely decreased.
+ * Returns whether it is safe to free() the structure now. */
+int statusrun_del(struct statusrun *run);
+
+/* Describe the state of prog as a space-separated list of tokens
+ * The description (like "running starting" or "dead quarantined") is
+ * written into buf, and truncated if it is longer than size.
+ * Returns buf. */
+char *prog_state(struct program *prog, char *buf, int size);
+
 #endif
@@ -21,24 +21,41 @@
 #define REQUEST_DIHNTR 4
 /* Do not update program flags */
 #define REQUEST_NOFLAGS 8
+/* (Internal) The start half of a default restart */
+#define REQUEST_RESTART 16
 
 /* get_reply() encountered an error */
 #define REPLY_ERROR 65535
 
+/* A client waiting for the result of an identical request that is already
+ * in progress
+ * Members:
+ * addr  : (struct addr) The address to send the reply to.
+ * cflags: (int) Flags to pass to the comm_*() functions.
+ * next  : (struct follower *) Linked list interconnection. */
+struct follower {
+    struct addr addr;
+    int cflags;
+    struct follower *next;
+};
+
 /* Server-side representation of a request, as populated and acted upon
  * by the functions in here.
  * Members:
- * config : (struct config *) The configuration this request is related to.
- * program: (struct program *) The program this request relates to.
- * action : (struct action *) The action to perform.
- * argv   : (char **) Auxillary command-line arguments for the action.
- *          The only dynamically allocated member of the structure; may
- *          be NULL.
- * creds  : (struct ucred) Credentials of the process to submit the request.
- * fds    : (int [3]) A set of file descriptors to pass to the script.
- * addr   : (struct addr) The address to send replies to.
- * cflags : (int) Flags to pass to the comm_*() functions.
- * flags  : (int) Bitwise OR of zero, one, or more REQUEST_* constants. */
+ * config   : (struct config *) The configuration this request is related
+ *            to.
+ * program  : (struct program *) The program this request relates to.
+ * action   : (struct action *) The action to perform.
+ * argv     : (char **) Auxillary command-line arguments for the action.
+ *            Dynamically allocated (like followers); may be NULL.
+ * creds    : (struct ucred) Credentials of the process to submit the
+ *            request.
+ * fds      : (int [3]) A set of file descriptors to pass to the script.
+ * addr     : (struct addr) The address to send replies to.
+ * cflags   : (int) Flags to pass to the comm_*() functions.
+ * flags    : (int) Bitwise OR of zero, one, or more REQUEST_* constants.
+ * followers: (struct follower *) Clients of identical requests that have
+ *            been attached to this one, and receive the same reply. */
 struct request {
     struct config *config;
     struct program *program;
@@ -49,6 +66,7 @@ struct request {
     struct addr addr;
     int cflags;
     int flags;
+    struct follower *followers;
 };
 
 /* String array
@@ -61,6 +79,15 @@ struct strarr {
     char **data;
 };
 
+/* Decide whether to admit a request from the given UID
+ * This is checked before a request is created from a message; see the
+ * rate-limit, uid-rate-limit, max-inflight, and uid-max-inflight settings
+ * in config.h. Admitting a request takes a token from the buckets
+ * concerned. UID 0 is always admitted.
+ * Returns 1 if the request is admitted, 0 if not (storing a description
+ * of the reason in *reason), or -1 on error (with errno set). */
+int request_admit(struct config *config, int uid, char **reason);
+
 /* Create a request from the given message
  * It is assumed that the message was verified to contain an appropriate
  * command.
@@ -101,6 +128,16 @@ struct job *request_schedule(struct request *request, double notBefore);
 /* Perform the given action
  * Might submit additional jobs to the configuration's queue, and (the entire
  * action) might finish asynchronously.
+ * The default status action is answered directly: the reply consists of
+ * "OK", the status code (0 if the program is running, 1 if not), and the
+ * fields "state=<starting, running, or stopped>", "pid=<PID>" and
+ * "uptime=<seconds since start>" (the latter two only if running), and
+ * "exit=<status of the latest process>" (if any has exited yet).
+ * Requests identical (in program, action, and arguments) to one still in
+ * progress are not performed again, but receive the reply of the latter;
+ * this applies to starts that are pending, default restarts that have not
+ * started the program again yet, and default stops that are being waited
+ * for. Other actions are not idempotent, and are always performed.
  * Returns the PID of the process spawned (if any), 0 if none, or -1 on
  * error, with errno either set to 0 ("Success") on a non-fatal error, or
  * otherwise on a fatal one. */
@@ -111,6 +148,76 @@ int request_run(struct request *request);
  * are closed. */
 void request_free(struct request *request);
 
+/* Perform queued starts as far as the concurrency limit allows
+ * Starts whose dependencies are still starting are skipped.
+ * Returns the amount of starts performed, or -1 on error. */
+int run_starts(struct config *config);
+
+/* Mark the start of the given program as finished (if it is starting)
+ * This happens when the program has settled, has reported readiness, or
+ * has exited; a start request waiting for readiness is replied to. Queued starts that
+ * become possible are performed.
+ * Returns the amount of those, or -1 on error. */
+int finish_start(struct config *config, struct program *prog);
+
+/* Grace period (in seconds) after killing all programs during shutdown after
+ * which the daemon exits regardless of them */
+#define SHUTDOWN_GRACE 5
+
+/* Begin stopping all programs because the daemon is exiting
+ * No programs are started or restarted anymore afterwards. If shutting down
+ * is in progress already, the deadline is moved to the present instead.
+ * The programs are actually stopped by shutdown_step().
+ * Returns zero on success, or -1 on error. */
+int begin_shutdown(struct config *config);
+
+/* Stop the programs that may be stopped now during shutdown
+ * Programs are stopped once no running program depends on them; if the
+ * deadline has passed, all remaining ones are killed. To be called
+ * regularly while shutting down.
+ * Returns the amount of programs still running (or zero if those are to be
+ * abandoned), or -1 on error. */
+int shutdown_step(struct config *config);
+
+/* Send the given signal to the processes of the given program
+ * Depending on the kill mode of the program (see config.h), the signal is
+ * sent to its main process, to the process group of that, or to all
+ * processes in its cgroup.
+ * Returns zero on success, or -1 on error (with errno set). */
+int signal_program(struct program *prog, int sig);
+
+/* Determine the delay before restarting the given program automatically
+ * The restart is accounted for, and the restart delay is backed off as
+ * configured (see config.h). If the program has been restarted too often,
+ * it is quarantined (and its PROG_RUNNING flag is cleared).
+ * Returns the delay in seconds, or -1 if the program is not to be
+ * restarted. */
+double restart_backoff(struct program *prog);
+
+/* Re-evaluate the automatic CPU placement of all programs
+ * Programs that are running (or starting, if they are starting, which may
+ * be NULL; its process, if any, is not adjusted) and have a nonzero
+ * cpucount are placed anew (see cpumap.h); the processes of those whose
+ * placement has changed are moved accordingly.
+ * Returns zero on success, or -1 on error (with errno set). */
+int place_programs(struct config *config, struct program *starting);
+
+/* Process pending readiness notifications
+ * Notifications are read from the notify socket of config until there are
+ * none left; programs reporting readiness finish starting.
+ * Returns zero on success, or -1 on error (with errno set). */
+int handle_notify(struct config *config);
+
+/* Collect the PIDs reported by the spawner and continue the corresponding
+ * requests (in the spawns queue of config)
+ * If wait is true, blocks until all launches pending at the time of the
+ * call have been reported; otherwise, only those available right away are
+ * collected. If the spawner fails, it is not used anymore, and the launches
+ * still pending fail.
+ * Returns the amount of launches concluded, or -1 on error (with errno
+ * set). */
+int handle_spawns(struct config *config, int wait);
+
 /* Extract jobs matching the given PID from the queue and spawn them
  * pid may be -1, in that case jobs which do not wait on a particular PID
  * are run. retcode is passed through to the job_run().
@@ -138,7 +245,18 @@ int send_request(struct config *config, char **argv, int flags);
  * written to standard error. */
 int get_reply(struct config *config, struct strarr *data, int flags);
 
-/* Close all file descriptors not less than minfd */
-int close_from(int minfd);
+/* Retrieve the listing of all programs from the daemon
+ * The listing is requested page by page (see the LIST command in the
+ * manual); data receives the fields of all pages concatenated, i.e.
+ * "LISTING", "gen=<generation>", the kind of the listing ("full" or
+ * "delta"), and the names and states of the programs, without the
+ * continuation markers. If since is not NULL, only programs that have
+ * changed since that generation are requested (removed ones having the
+ * state "removed"); the daemon may send a full listing instead.
+ * The return value is as with get_reply(); 1 indicates a malformed reply.
+ * A listing that changes in a way preventing it from being continued is
+ * reported as an error message. */
+int get_listing(struct config *config, struct strarr *data, char *since,
+                int flags);
 
 #endif
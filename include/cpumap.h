@@ -0,0 +1,78 @@
+/* procmgr -- init-like process manager
+ * https://github.com/CylonicRaider/procmgr */
+
+/* CPU topology and placement
+ * The topology (which CPUs are online, which of them are hyperthreads of
+ * the same core, and which NUMA node they belong to) is read from sysfs.
+ * Programs are placed by choosing the least loaded NUMA node that has
+ * enough CPUs, and, inside it, the least loaded CPUs on the least loaded
+ * cores, so that programs are spread across nodes and cores before they
+ * share any. */
+
+/* Requires _GNU_SOURCE. */
+
+#ifndef _CPUMAP_H
+#define _CPUMAP_H
+
+#include <sched.h>
+
+/* Location of the CPU topology */
+#define CPUMAP_SYSFS_CPU "/sys/devices/system/cpu"
+#define CPUMAP_SYSFS_NODE "/sys/devices/system/node"
+
+/* Description of a single CPU
+ * Members:
+ * cpu : (int) The number of the CPU.
+ * core: (int) An index identifying the physical core the CPU belongs to
+ *       (CPUs sharing a core are hyperthreads of each other).
+ * node: (int) The NUMA node the CPU belongs to. */
+struct cpuinfo {
+    int cpu;
+    int core;
+    int node;
+};
+
+/* CPU topology of the system
+ * Members:
+ * count: (int) The amount of online CPUs.
+ * cores: (int) The amount of physical cores.
+ * nodes: (int) One more than the highest NUMA node number.
+ * cpus : (struct cpuinfo *) Descriptions of the online CPUs, ordered by
+ *        CPU number. */
+struct cpumap {
+    int count;
+    int cores;
+    int nodes;
+    struct cpuinfo *cpus;
+};
+
+/* Read the CPU topology of the system
+ * Missing information (like NUMA nodes on non-NUMA systems) is substituted
+ * by sensible defaults.
+ * Returns a new structure, or NULL on error (with errno set). */
+struct cpumap *cpumap_read(void);
+
+/* Free the given structure */
+void cpumap_free(struct cpumap *map);
+
+/* Choose count CPUs for a program
+ * load has an entry for every CPU in map (in the same order), telling how
+ * many programs use it already; the entries of the CPUs chosen are
+ * incremented. The CPUs chosen are stored into set. */
+void cpumap_place(struct cpumap *map, int *load, int count, cpu_set_t *set);
+
+/* Restrict all threads of the process pid to the given set of CPUs
+ * Threads that vanish in the meantime are ignored.
+ * Returns zero on success, or -1 on error (with errno set). */
+int cpuset_apply(int pid, cpu_set_t *set);
+
+/* Parse a list of CPU numbers and ranges, like "0-3,8"
+ * Returns nonzero on success, or zero on error (with errno set). */
+int cpuset_parse(cpu_set_t *ret, char *value);
+
+/* Format the given set as a list of CPU numbers and ranges
+ * The result is truncated if buf is too small.
+ * Returns buf. */
+char *cpuset_format(cpu_set_t *set, char *buf, int size);
+
+#endif
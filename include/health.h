@@ -0,0 +1,92 @@
+/* procmgr -- init-like process manager
+ * https://github.com/CylonicRaider/procmgr */
+
+/* Health checks
+ * A program can be checked periodically while it is running, by running a
+ * command (which must exit with status 0), by connecting to a UNIX domain
+ * socket or a TCP port, or by looking at the modification time of a file
+ * (which must have been modified within the timeout). Checks run from the
+ * job queue of the daemon without blocking it; a program failing a given
+ * amount of consecutive checks is restarted. */
+
+/* Requires _GNU_SOURCE. */
+
+#ifndef _HEALTH_H
+#define _HEALTH_H
+
+/* Kinds of health checks */
+#define HEALTH_EXEC 1    /* Run a command */
+#define HEALTH_CONNECT 2 /* Connect to a socket */
+#define HEALTH_MTIME 3   /* Check the modification time of a file */
+
+/* Default settings */
+#define HEALTH_INTERVAL 10
+#define HEALTH_TIMEOUT 5
+#define HEALTH_THRESHOLD 3
+
+struct config;
+struct program;
+
+/* Health check configuration of a program
+ * Members:
+ * type     : (int) The kind of check (one of the HEALTH_* constants).
+ * target   : (char *) The command to run, the address to connect to (a
+ *            path for UNIX domain sockets, or a port optionally preceded by
+ *            a numerical host address and a colon), or the file to check.
+ * execpath : (char *) For HEALTH_EXEC, the executable to run the command
+ *            directly with, as resolved when the configuration is loaded,
+ *            or NULL if the command is run by the shell.
+ * execargv : (char **) The argument vector to go with execpath, or NULL.
+ * interval : (int) The time (in seconds) between the starts of checks.
+ * timeout  : (int) The time (in seconds) after which a check counts as
+ *            failed; for HEALTH_MTIME, the maximum age of the file.
+ * threshold: (int) The amount of consecutive failures after which the
+ *            program is restarted. */
+struct healthcheck {
+    int type;
+    char *target;
+    char *execpath;
+    char **execargv;
+    int interval;
+    int timeout;
+    int threshold;
+};
+
+/* Run-time health check state of a program
+ * Members:
+ * fails     : (int) The amount of consecutive failed checks.
+ * pid       : (int) The PID of the command of a HEALTH_EXEC check in
+ *             progress, or -1 if none.
+ * fd        : (int) The socket of a HEALTH_CONNECT check in progress, or
+ *             -1 if none.
+ * next      : (double) The timestamp at which the next check is due.
+ * deadline  : (double) The timestamp at which the check in progress fails.
+ * restarting: (int) Whether the program has been restarted for failing its
+ *             checks; no further checks happen until it is started anew. */
+struct healthstate {
+    int fails;
+    int pid;
+    int fd;
+    double next;
+    double deadline;
+    int restarting;
+};
+
+/* Parse a health check specification, like "connect 8080"
+ * The remaining members are set to their defaults (the command of a
+ * HEALTH_EXEC check is run by the shell).
+ * Returns a newly allocated structure, or NULL on error (with errno set). */
+struct healthcheck *health_parse(char *value);
+
+/* Free the given structure */
+void health_free(struct healthcheck *hc);
+
+/* Begin checking the health of the given program, which has just been
+ * started
+ * Does nothing if the program has no health check configured. The checks
+ * end when the program exits or is started anew; a check in progress is
+ * abandoned then.
+ * Returns zero on success, or -1 on error (with errno set). */
+int health_schedule(struct config *config, struct program *prog);
+
+#endif
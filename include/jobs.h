@@ -97,6 +97,11 @@ void jobqueue_prepend(struct jobqueue *queue, struct job *job);
 /* Append a job to the queue */
 void jobqueue_append(struct jobqueue *queue, struct job *job);
 
+/* Insert a job into the queue before another one
+ * If before is NULL, the job is appended. */
+void jobqueue_insert(struct jobqueue *queue, struct job *before,
+                     struct job *job);
+
 /* Extract the given job from the queue, and return it */
 struct job *jobqueue_take(struct jobqueue *queue, struct job *job);
 
@@ -107,4 +112,10 @@ struct job *jobqueue_take(struct jobqueue *queue, struct job *job);
  * from the queue itself; the return value may be NULL. */
 struct job *jobqueue_getfor(struct jobqueue *queue, int pid);
 
+/* Return the earliest timestamp at which a job not waiting for a process
+ * becomes due
+ * Jobs with a NaN notBefore are due immediately (i.e. at the current
+ * timestamp). Returns INFINITY if there are no such jobs. */
+double jobqueue_due(struct jobqueue *queue);
+
 #endif
@@ -0,0 +1,191 @@
+/* procmgr -- init-like process manager
+ * https://github.com/CylonicRaider/procmgr */
+
+/* Process spawning
+ * Children are created by clone() with CLONE_VM and CLONE_VFORK, i.e. they
+ * share the address space of the daemon (which is suspended until the child
+ * has called execve() or exited) instead of receiving a copy of it; this way,
+ * the cost of spawning a process does not grow with the size of the daemon.
+ * As a consequence, the child must not allocate memory or use stdio; all the
+ * data it needs are prepared by the caller in a struct launch.
+ * Alternatively, spawning can be delegated to a helper process (the
+ * "spawner"), which is forked before the configuration is loaded and hence
+ * has a small address space; descriptions of processes are sent to it over
+ * a socket, and it creates children on behalf of the daemon (which remains
+ * their parent, so that it can wait for them as usual). The daemon does not
+ * wait for the spawner; it collects the PIDs of the children (which arrive
+ * in the order the descriptions were sent) when they are reported. */
+
+/* Requires _GNU_SOURCE. */
+
+#ifndef _LAUNCH_H
+#define _LAUNCH_H
+
+#include <sched.h>
+#include <sys/resource.h>
+
+/* Empty initializer for a struct launch */
+#define LAUNCH_INIT { NULL, -1, NULL, NULL, NULL, 0, { -1, -1, -1 }, -1, \
+                      -1, NULL, NULL, NULL, 0 }
+
+/* Put the child into a new process group */
+#define LAUNCH_SETPGID 1
+/* (Internal) Make the child a sibling of the calling process */
+#define LAUNCH_SIBLING 2
+
+/* Members of struct procattr that are set */
+#define PROCATTR_CPUS   1 /* cpus */
+#define PROCATTR_NICE   2 /* nice */
+#define PROCATTR_IOPRIO 4 /* ioprio */
+#define PROCATTR_OOMADJ 8 /* oomadj */
+
+/* Maximum amount of entries in an executable cache */
+#define EXECCACHE_MAX 64
+
+/* Exit code of a child that failed to set itself up */
+#define LAUNCH_ESETUP 126
+/* Exit code of a child that failed to execute its program */
+#define LAUNCH_EEXEC 127
+
+/* Description of a process to spawn
+ * Members:
+ * path    : (char *) The executable to run, or NULL for none; in the latter
+ *           case, the child writes message to its standard output and exits
+ *           with the status code exitcode.
+ * execfd  : (int) A descriptor referring to path (as obtained from
+ *           execcache_get()), or -1. If valid, the executable is run via
+ *           the descriptor, avoiding another path lookup; path is used as
+ *           a fallback (e.g. for interpreted scripts).
+ * argv    : (char **) The argument vector to pass to the executable.
+ * envp    : (char **) The environment to pass to the executable.
+ * message : (char *) Text to write to standard output if path is NULL.
+ *           May be NULL.
+ * exitcode: (int) Status code to exit with if path is NULL.
+ * fds     : (int [3]) File descriptors to install as the standard I/O
+ *           streams of the child; -1 closes the corresponding stream.
+ * uid     : (int) UID to switch to, or -1 to retain the current one.
+ * gid     : (int) GID to switch to, or -1 to retain the current one.
+ * cwd     : (char *) Directory to change into, or NULL to stay.
+ * cgroup  : (char *) A cgroup (v2) directory to create the child in, or
+ *           NULL to stay in the current one.
+ * attr    : (struct procattr *) Scheduling attributes and resource limits
+ *           to apply to the child, or NULL for none.
+ * flags   : (int) Bitmask of LAUNCH_* constants. */
+struct launch {
+    char *path;
+    int execfd;
+    char **argv;
+    char **envp;
+    char *message;
+    int exitcode;
+    int fds[3];
+    int uid;
+    int gid;
+    char *cwd;
+    char *cgroup;
+    struct procattr *attr;
+    int flags;
+};
+
+/* Scheduling attributes and resource limits of a process
+ * Members:
+ * flags  : (int) Bitmask of PROCATTR_* constants indicating which of the
+ *          other members are to be applied.
+ * cpus   : (cpu_set_t) The CPUs the process may run on.
+ * nice   : (int) The nice value of the process.
+ * ioprio : (int) The I/O priority of the process, as passed to
+ *          ioprio_set(2).
+ * oomadj : (int) The OOM killer score adjustment of the process.
+ * rlimset: (int) Bitmask of the resource limits to apply (bit N being set
+ *          meaning that rlimits[N] is to be applied).
+ * rlimits: (struct rlimit []) Resource limits, indexed by the RLIMIT_*
+ *          constants. */
+struct procattr {
+    int flags;
+    cpu_set_t cpus;
+    int nice;
+    int ioprio;
+    int oomadj;
+    int rlimset;
+    struct rlimit rlimits[RLIM_NLIMITS];
+};
+
+/* Cached descriptor of an executable
+ * Members:
+ * path: (char *) The path the executable was opened by.
+ * fd  : (int) An O_PATH descriptor of the executable.
+ * next: (struct execfile *) Linked list interconnection. */
+struct execfile {
+    char *path;
+    int fd;
+    struct execfile *next;
+};
+
+/* Spawn a child process as described by l
+ * Signal handlers are reset to their defaults in the child; other
+ * descriptors than the standard I/O ones are closed.
+ * If a cgroup is specified, the child is created by clone3() directly in
+ * it instead; as that system call cannot share the address space safely
+ * without assembly glue, the child is a copy of the caller in that case.
+ * On kernels that do not support that, the child joins the cgroup right
+ * after being created.
+ * Returns the PID of the child, -2 if the child could not be placed into
+ * its cgroup (e.g. because the cgroup is missing or not writable; a child
+ * that failed to join it has exited already), or -1 on other errors (with
+ * errno set in both cases). Other failures happening in the child after it
+ * has been created are reported on its standard error stream, and make it
+ * exit with LAUNCH_ESETUP or LAUNCH_EEXEC. */
+int launch(struct launch *l);
+
+/* Obtain a descriptor of the executable at path from the given cache
+ * The executable is opened and added to the cache if it is not present
+ * already (and the cache holds less than EXECCACHE_MAX entries); if path
+ * does not resolve to the cached executable anymore (because it has been
+ * removed or replaced, or a symbolic link has been changed), it is
+ * re-opened. Only absolute paths are cached.
+ * Returns the descriptor (which remains owned by the cache), or -1 if none
+ * is available. */
+int execcache_get(struct execfile **cache, char *path);
+
+/* Close all descriptors in the given cache and empty it */
+void execcache_flush(struct execfile **cache);
+
+/* Start a spawner process
+ * Must be called by the process that is to become the parent of the
+ * children spawned. If cwd is not NULL, the spawner changes into that
+ * directory (to match a daemon that will do so later).
+ * Returns a socket connected to the spawner to be used with
+ * launch_remote(), or -1 on error (with errno set). The spawner exits when
+ * the socket is closed. */
+int spawner_start(char *cwd);
+
+/* Submit a child process as described by l to be spawned by the spawner
+ * connected to by fd
+ * The outcome is to be collected by launch_result() later. Standard I/O
+ * descriptors that are -1 are left closed in the child, as with launch().
+ * If the description is too large to be sent, E2BIG is returned; if the
+ * spawner is too far behind to accept it right now, EAGAIN is returned.
+ * Returns zero on success, or -1 on error (with errno set; errors
+ * indicating that the spawner is defunct include EPIPE and ECONNRESET). */
+int launch_remote(int fd, struct launch *l);
+
+/* Collect the outcome of the earliest launch submitted to the spawner
+ * connected to by fd that has not been collected yet
+ * flags is passed on to comm_recv(); with COMM_DONTWAIT, the call returns
+ * immediately if no outcome is available.
+ * Returns 1 if an outcome has been collected, storing either the PID of the
+ * child or what launch() returned on failure (with errno set to the reason
+ * reported by the spawner) into *pid; 0 if none is available; or -1 on
+ * communication errors (with errno set; EPIPE if the spawner has
+ * exited). */
+int launch_result(int fd, int *pid, int flags);
+
+/* Close all file descriptors not less than minfd
+ * If lazy is true, close_range() is used to mark them as close-on-exec
+ * instead where supported (which is cheaper, and equivalent for a process
+ * about to exec()); otherwise, the descriptors are closed (individually on
+ * kernels that do not support close_range()). Does not allocate memory,
+ * and is thus safe to use in children created by launch(). */
+int close_from(int minfd, int lazy);
+
+#endif
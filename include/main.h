@@ -24,19 +24,24 @@ enum cmdaction { SPAWN, TEST, STOP, RELOAD, LIST };
  * Members:
  * action: (enum cmdaction) The actual action to perform.
  * flags : (int) A bitmask of CLIENTACT_* constants.
+ * since : (char *) For LIST, the generation to list the changes since, or
+ *         NULL to list all programs.
  */
 struct client_action {
     enum cmdaction action;
     int flags;
+    char *since;
 };
 
 /* Server main loop
- * background specifies whether to fork into background. pidfile is either
+ * readyfd is the file descriptor returned by daemonize() if the daemon is
+ * going into background (the setup is finished using daemonize_done()
+ * before the main loop is entered), or -1 if not. pidfile is either
  * NULL or the location of a file to store the process ID of the daemon in.
  * argv is verified not to contain anything; it is an error to have anything
  * in it.
  * Returns 0 on success, or a positive integer on failure. */
-int server_main(struct config *config, int background, char *pidfile,
+int server_main(struct config *config, int readyfd, char *pidfile,
                 char *argv[]);
 
 /* Client main function
@@ -0,0 +1,138 @@
+/* procmgr -- init-like process manager
+ * https://github.com/CylonicRaider/procmgr */
+
+/* Shared-memory status page
+ * The daemon can publish the state of all programs in a file, which other
+ * processes (e.g. monitoring agents) map into their memory to read the
+ * state without talking to the daemon at all.
+ * The file consists of a struct statushdr followed by capacity struct
+ * statusrec entries, of which the first count are valid. The records are
+ * protected by a sequence lock: a reader copies seq (retrying while it is
+ * odd), reads whatever it needs, and retries if seq has changed meanwhile.
+ * The file only ever grows; if capacity exceeds the size a reader has
+ * mapped, it should map the file anew. heartbeat is incremented (outside
+ * the lock) every time the main loop of the daemon runs, which happens at
+ * least once a second; if it stops changing, the daemon is hung or gone.
+ * All members are in native byte order. */
+
+/* Requires _GNU_SOURCE. */
+
+#ifndef _STATUSPAGE_H
+#define _STATUSPAGE_H
+
+#include <stdint.h>
+
+/* Identification of the file format */
+#define STATUSPAGE_MAGIC 0x53504d50 /* "PMPS" in little-endian order */
+#define STATUSPAGE_VERSION 1
+
+/* Size of the name member of struct statusrec; longer names are
+ * truncated */
+#define STATUSPAGE_NAMELEN 112
+
+/* Initial amount of records the file has space for */
+#define STATUSPAGE_CAPACITY 64
+
+/* Values of the state member of struct statusrec */
+#define STATUSPAGE_STOPPED 0     /* Not running */
+#define STATUSPAGE_STARTING 1    /* Being spawned, or running but not
+                                  * settled/ready yet */
+#define STATUSPAGE_RUNNING 2     /* Running */
+#define STATUSPAGE_QUEUED 3      /* Not running; a start is pending */
+#define STATUSPAGE_QUARANTINED 4 /* Not running; restarted too often */
+
+struct config;
+
+/* Header of the status page
+ * Members:
+ * magic    : (uint32_t) STATUSPAGE_MAGIC.
+ * version  : (uint32_t) STATUSPAGE_VERSION.
+ * hdrsize  : (uint32_t) The size of this structure; the records start
+ *            right after it.
+ * recsize  : (uint32_t) The size of a struct statusrec.
+ * pid      : (int32_t) The PID of the daemon.
+ * seq      : (uint32_t) The sequence counter; odd while the records are
+ *            being updated.
+ * capacity : (uint32_t) The amount of records the file has space for.
+ * count    : (uint32_t) The amount of valid records.
+ * heartbeat: (uint64_t) Incremented by every iteration of the main loop of
+ *            the daemon.
+ * updated  : (double) The timestamp of the latest change of the records. */
+struct statushdr {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t hdrsize;
+    uint32_t recsize;
+    int32_t pid;
+    uint32_t seq;
+    uint32_t capacity;
+    uint32_t count;
+    uint64_t heartbeat;
+    double updated;
+};
+
+/* Status record of a program
+ * Members:
+ * name    : (char []) The name of the program, NUL-terminated (and padded).
+ * state   : (int32_t) One of the STATUSPAGE_* state constants.
+ * pid     : (int32_t) The PID of the program, or -1 if it is not running.
+ * started : (double) The timestamp of the latest start of the program, or
+ *           0 if it has not been started yet.
+ * exited  : (double) The timestamp at which the latest process of the
+ *           program exited, or 0 if none has yet.
+ * exitcode: (int32_t) The exit status of that process (negative signal
+ *           numbers for processes killed by signals).
+ * restarts: (uint32_t) The amount of automatic restarts of the program
+ *           since the daemon started. */
+struct statusrec {
+    char name[STATUSPAGE_NAMELEN];
+    int32_t state;
+    int32_t pid;
+    double started;
+    double exited;
+    int32_t exitcode;
+    uint32_t restarts;
+};
+
+/* Run-time state of a status page being published
+ * Members:
+ * path    : (char *) The path of the file.
+ * fd      : (int) The file descriptor of the file.
+ * header  : (struct statushdr *) The beginning of the mapping of the file.
+ * records : (struct statusrec *) The records, right after the header.
+ * shadow  : (struct statusrec *) A private copy of the records, in which
+ *           updates are prepared to tell whether anything has changed.
+ * capacity: (int) The amount of records the mapping and shadow have space
+ *           for.
+ * generation: (unsigned long long) The generation of the configuration
+ *           (see config_track()) whose programs have last been published
+ *           completely, or 0 if none. */
+struct statuspage {
+    char *path;
+    int fd;
+    struct statushdr *header;
+    struct statusrec *records;
+    struct statusrec *shadow;
+    int capacity;
+    unsigned long long generation;
+};
+
+/* Create the status page file at path (replacing any file there) and map
+ * it into memory
+ * Returns a newly allocated structure, or NULL on error (with errno set). */
+struct statuspage *statuspage_open(char *path);
+
+/* Publish the current state of the programs of config to the page and
+ * increment the heartbeat
+ * The records are only rebuilt if config_track() reports a change of the
+ * programs since the last update, and only rewritten (and seq incremented)
+ * if they differ from the published ones.
+ * Returns zero on success, or -1 on error (with errno set; the page is
+ * left unchanged apart from the heartbeat then). */
+int statuspage_update(struct statuspage *page, struct config *config);
+
+/* Unmap the page and free the structure, removing the file if remove is
+ * true */
+void statuspage_close(struct statuspage *page, int remove);
+
+#endif
@@ -12,9 +12,20 @@
 /* The current UNIX timestamp as a double-precision floating-point value */
 double timestamp(void);
 
-/* Fork into background */
+/* Fork into background
+ * The original process waits until the child (which continues in a new
+ * session) reports success via daemonize_done(), and exits with the
+ * status reported (or 1 if the child exits without reporting one).
+ * Returns a file descriptor for daemonize_done(), or -1 on error (with
+ * errno set). */
 int daemonize(void);
 
+/* Finish going into background
+ * status (0-255) is reported to the original process via fd, which is
+ * closed, and the working directory is changed to the root directory.
+ * Returns zero on success, or -1 on error (with errno set). */
+int daemonize_done(int fd, int status);
+
 /* Parse an integer, optionally interpreting certain keywords
  * ret is a pointer to the integer that will contain the value if the call
  * succeeds; value is the string to parse. keywords is a bitmask of INTKWD_*
@@ -23,4 +34,12 @@ int daemonize(void);
  */
 int parse_int(int *ret, char *value, int keywords);
 
+/* Parse a floating-point number
+ * Returns nonzero in case of success and zero otherwise, with errno set. */
+int parse_double(double *ret, char *value);
+
+/* Concatenate two strings into a newly allocated one
+ * Returns the new string, or NULL if allocation fails. */
+char *concat(char *s1, char *s2);
+
 #endif
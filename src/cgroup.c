@@ -0,0 +1,123 @@
+/* procmgr -- init-like process manager
+ * https://github.com/CylonicRaider/procmgr */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "cgroup.h"
+
+/* Static functions */
+static int enable_controller(int dirfd, char *name);
+static int write_value(int dirfd, char *name, char *value, int optional);
+
+/* Ensure that the cgroup at path exists and has the given limits applied */
+int cgroup_setup(char *path, struct cglimits *limits) {
+    char *parent, *p, buf[64];
+    int pfd = -1, dfd = -1, ret = -1;
+    /* Locate parent cgroup */
+    parent = strdup(path);
+    if (! parent) return -1;
+    p = strrchr(parent, '/');
+    if (! p || p == parent) {
+        errno = EINVAL;
+        goto end;
+    }
+    *p = '\0';
+    pfd = open(parent, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (pfd == -1) goto end;
+    /* Enable the controllers needed */
+    if (limits->memory_max && enable_controller(pfd, "+memory") == -1)
+        goto end;
+    if (limits->cpu_weight != -1 && enable_controller(pfd, "+cpu") == -1)
+        goto end;
+    if (limits->io_weight != -1 && enable_controller(pfd, "+io") == -1)
+        goto end;
+    /* Create cgroup */
+    if (mkdirat(pfd, p + 1, 0755) == -1 && errno != EEXIST) goto end;
+    dfd = openat(pfd, p + 1, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dfd == -1) goto end;
+    /* Apply limits */
+    if (write_value(dfd, "memory.max", (limits->memory_max) ?
+            limits->memory_max : CGROUP_MEMORY_MAX,
+            ! limits->memory_max) == -1)
+        goto end;
+    snprintf(buf, sizeof(buf), "%d", (limits->cpu_weight != -1) ?
+             limits->cpu_weight : CGROUP_WEIGHT);
+    if (write_value(dfd, "cpu.weight", buf, limits->cpu_weight == -1) == -1)
+        goto end;
+    snprintf(buf, sizeof(buf), "default %d", (limits->io_weight != -1) ?
+             limits->io_weight : CGROUP_WEIGHT);
+    if (write_value(dfd, "io.weight", buf, limits->io_weight == -1) == -1)
+        goto end;
+    ret = 0;
+    end:
+        if (dfd != -1) close(dfd);
+        if (pfd != -1) close(pfd);
+        free(parent);
+        return ret;
+}
+
+/* Send the given signal to all processes in the cgroup at path */
+int cgroup_signal(char *path, int sig) {
+    char buf[32];
+    FILE *fp;
+    int dfd, fd, pid, ret = 0;
+    dfd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dfd == -1) return -1;
+    if (sig == SIGKILL && write_value(dfd, "cgroup.kill", "1", 0) == 0) {
+        close(dfd);
+        return 1;
+    }
+    fd = openat(dfd, "cgroup.procs", O_RDONLY | O_CLOEXEC);
+    close(dfd);
+    if (fd == -1) return -1;
+    fp = fdopen(fd, "r");
+    if (! fp) {
+        close(fd);
+        return -1;
+    }
+    while (fgets(buf, sizeof(buf), fp)) {
+        pid = atoi(buf);
+        if (pid > 0 && kill(pid, sig) == 0) ret++;
+    }
+    fclose(fp);
+    return ret;
+}
+
+/* Validate a value for the memory_max member of struct cglimits */
+int cgroup_check_memory(char *value) {
+    char *end;
+    if (strcmp(value, "max") == 0) return 1;
+    if (*value < '0' || *value > '9') goto error;
+    errno = 0;
+    strtoull(value, &end, 10);
+    if (errno) goto error;
+    if (*end == 'K' || *end == 'M' || *end == 'G') end++;
+    if (*end) goto error;
+    return 1;
+    error:
+        errno = EINVAL;
+        return 0;
+}
+
+/* Enable the given controller for the children of the cgroup at dirfd */
+int enable_controller(int dirfd, char *name) {
+    return write_value(dirfd, "cgroup.subtree_control", name, 0);
+}
+
+/* Write value into the file name in the directory dirfd
+ * If optional is true, a missing file is not an error. */
+int write_value(int dirfd, char *name, char *value, int optional) {
+    int fd, len = strlen(value), ret = 0;
+    fd = openat(dirfd, name, O_WRONLY | O_CLOEXEC);
+    if (fd == -1) return (optional && errno == ENOENT) ? 0 : -1;
+    if (write(fd, value, len) == -1) ret = -1;
+    close(fd);
+    return ret;
+}
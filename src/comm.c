@@ -12,7 +12,7 @@
 #define ANCBUF_SIZE 256
 
 /* Static function */
-static int setup_addr(struct sockaddr_un *addr, struct config *conf);
+static int setup_addr(struct sockaddr_un *addr, char *path);
 
 /* Deallocate all the ressources associated with the given message */
 void comm_del(struct ctlmsg *msg) {
@@ -47,9 +47,9 @@ int comm_listen(struct config *conf) {
     /* Remove old path; ignore errors */
     unlink(conf->socketpath);
     /* Set up address */
-    if (setup_addr(&addr, conf) == -1) return -1;
+    if (setup_addr(&addr, conf->socketpath) == -1) return -1;
     /* Create socket */
-    int fd = socket(AF_UNIX, SOCK_DGRAM, 0);
+    int fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
     if (fd == -1)
         return -1;
     /* Change file permissions */
@@ -81,9 +81,9 @@ int comm_connect(struct config *conf) {
     struct sockaddr_un addr;
     int one = 1;
     /* Set up address */
-    if (setup_addr(&addr, conf) == -1) return -1;
+    if (setup_addr(&addr, conf->socketpath) == -1) return -1;
     /* Create socket */
-    int fd = socket(AF_UNIX, SOCK_DGRAM, 0);
+    int fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
     if (fd == -1)
         return -1;
     /* Connect */
@@ -127,9 +127,11 @@ int comm_recv(int fd, struct ctlmsg *msg, struct addr *addr, int flags) {
     hdr.msg_iovlen = 1;
     hdr.msg_control = credbuf;
     hdr.msg_controllen = sizeof(credbuf);
-    hdr.msg_flags = (flags & COMM_DONTWAIT) ? MSG_DONTWAIT : 0;
-    /* Actually read message */
-    ret = recvmsg(fd, &hdr, 0);
+    hdr.msg_flags = 0;
+    /* Actually read message; file descriptors received are not to be
+     * inherited by children other than the ones they are meant for */
+    ret = recvmsg(fd, &hdr, MSG_CMSG_CLOEXEC |
+                  ((flags & COMM_DONTWAIT) ? MSG_DONTWAIT : 0));
     if (ret == -1) {
         if (flags & COMM_DONTWAIT && (errno == EAGAIN ||
                                       errno == EWOULDBLOCK)) {
@@ -240,7 +242,7 @@ int comm_send(int fd, struct ctlmsg *msg, struct addr *addr, int flags) {
     hdr.msg_iovlen = 1;
     hdr.msg_control = credbuf;
     hdr.msg_controllen = CMSG_SPACE(sizeof(struct ucred));
-    hdr.msg_flags = (flags & COMM_DONTWAIT) ? MSG_DONTWAIT : 0;
+    hdr.msg_flags = 0;
     /* Populate ancillary messages */
     cmsg = CMSG_FIRSTHDR(&hdr);
     cmsg->cmsg_len = CMSG_LEN(sizeof(struct ucred));
@@ -256,8 +258,10 @@ int comm_send(int fd, struct ctlmsg *msg, struct addr *addr, int flags) {
         cmsg->cmsg_type = SCM_RIGHTS;
         memcpy(CMSG_DATA(cmsg), msg->fds, sizeof(msg->fds));
     }
-    /* Send message */
-    ret = sendmsg(fd, &hdr, 0);
+    /* Send message; a (connected) peer having gone away is reported as an
+     * error instead of killing the process */
+    ret = sendmsg(fd, &hdr, MSG_NOSIGNAL |
+                  ((flags & COMM_DONTWAIT) ? MSG_DONTWAIT : 0));
     if (ret == -1 && flags & COMM_DONTWAIT && (errno == EAGAIN ||
         errno == EWOULDBLOCK)) return -2;
     return ret;
@@ -275,15 +279,76 @@ int comm_senderr(int fd, char *errcode, char *errmsg, struct addr *addr,
     return comm_send(fd, &msg, addr, flags);
 }
 
+/* Set up the socket for receiving readiness notifications */
+int comm_listen_notify(struct config *conf) {
+    struct sockaddr_un addr;
+    int one = 1;
+    /* Remove old path; ignore errors */
+    unlink(conf->notifypath);
+    if (setup_addr(&addr, conf->notifypath) == -1) return -1;
+    /* Create and bind socket; programs might be running as any user */
+    int fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+    if (fd == -1)
+        return -1;
+    if (bind(fd, (struct sockaddr *) &addr, sizeof(addr)) == -1)
+        goto error;
+    if (chmod(conf->notifypath, 0777) == -1)
+        goto error;
+    /* Senders are identified by their credentials */
+    if (setsockopt(fd, SOL_SOCKET, SO_PASSCRED, &one, sizeof(one)) == -1)
+        goto error;
+    if (conf->notify != -1) close(conf->notify);
+    conf->notify = fd;
+    return fd;
+    error:
+        close(fd);
+        return -1;
+}
+
+/* Receive a readiness notification */
+int comm_recv_notify(int fd, char *buf, int size, int *pid) {
+    char credbuf[ANCBUF_SIZE];
+    struct iovec bufvec;
+    struct msghdr hdr;
+    struct cmsghdr *cmsg;
+    int ret;
+    bufvec.iov_base = buf;
+    bufvec.iov_len = size - 1;
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.msg_iov = &bufvec;
+    hdr.msg_iovlen = 1;
+    hdr.msg_control = credbuf;
+    hdr.msg_controllen = sizeof(credbuf);
+    ret = recvmsg(fd, &hdr, MSG_DONTWAIT | MSG_CMSG_CLOEXEC);
+    if (ret == -1) {
+        return (errno == EAGAIN || errno == EWOULDBLOCK) ? -2 : -1;
+    }
+    buf[ret] = '\0';
+    *pid = -1;
+    for (cmsg = CMSG_FIRSTHDR(&hdr); cmsg; cmsg = CMSG_NXTHDR(&hdr, cmsg)) {
+        if (cmsg->cmsg_level != SOL_SOCKET) continue;
+        if (cmsg->cmsg_type == SCM_CREDENTIALS) {
+            struct ucred *creds = (struct ucred *) CMSG_DATA(cmsg);
+            *pid = creds->pid;
+        } else if (cmsg->cmsg_type == SCM_RIGHTS) {
+            /* Not expected; do not leak them */
+            int *fds = (int *) CMSG_DATA(cmsg);
+            int len = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+            while (len--) close(*fds++);
+        }
+    }
+    return ret;
+}
+
 /* Common address preparation */
-static int setup_addr(struct sockaddr_un *addr, struct config *conf) {
+static int setup_addr(struct sockaddr_un *addr, char *path) {
     /* Verify path isn't too long */
-    if (strlen(conf->socketpath) > sizeof(addr->sun_path)) {
+    if (strlen(path) > sizeof(addr->sun_path)) {
         errno = ENAMETOOLONG;
         return -1;
     }
     /* Set up structure */
     addr->sun_family = AF_UNIX;
-    strncpy(addr->sun_path, conf->socketpath, sizeof(addr->sun_path));
+    strncpy(addr->sun_path, path, sizeof(addr->sun_path));
     return 0;
 }
@@ -1,9 +1,13 @@
 /* procmgr -- init-like process manager
  * https://github.com/CylonicRaider/procmgr */
 
+#define _GNU_SOURCE
+#include <ctype.h>
 #include <errno.h>
 #include <string.h>
 #include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "logging.h"
 #include "config.h"
@@ -12,24 +16,68 @@
 /* Static functions/constants */
 static struct action **action_pointer(struct program *prog, char *name);
 static void action_free(struct action **act);
+static int tokenize_command(char *command, int shell, char **path,
+                            char ***argv);
+static int action_prepare(struct config *conf, struct program *prog,
+                          struct action *act);
+static int parse_shell(int *ret, char *value);
+static int parse_weight(int *ret, char *value);
+static int check_deps(struct program *list, struct program *prog,
+                      int quiet);
+static int parse_procattr(struct procattr *attr, struct section *config);
+static int parse_ioprio(int *ret, char *value);
+static int parse_rlimit(struct rlimit *ret, char *value);
+static int parse_rlim(rlim_t *ret, char *value);
+static char **split_command(char *command);
+static char *resolve_command(char *name);
+static void free_strings(char **list);
 
 static struct actionname {
-    char *base, *cmd, *uid, *gid, *suid, *sgid;
+    char *base, *cmd, *uid, *gid, *suid, *sgid, *shell;
 } action_names[] = {
     { "start",   "cmd-start",    "uid-start",   "gid-start",
-                 "suid-start",   "sgid-start"                  },
+                 "suid-start",   "sgid-start",  "shell-start"   },
     { "restart", "cmd-restart",  "uid-restart", "gid-restart",
-                 "suid-restart", "sgid-restart"                },
+                 "suid-restart", "sgid-restart", "shell-restart" },
     { "reload",  "cmd-reload",   "uid-reload",  "gid-reload",
-                 "suid-reload",  "sgid-reload"                 },
+                 "suid-reload",  "sgid-reload", "shell-reload"  },
     { "signal",  "cmd-signal",   "uid-signal",  "gid-signal",
-                 "suid-signal",  "sgid-signal"                 },
+                 "suid-signal",  "sgid-signal", "shell-signal"  },
     { "stop",    "cmd-stop",     "uid-stop",    "gid-stop",
-                 "suid-stop",    "sgid-stop"                   },
+                 "suid-stop",    "sgid-stop",   "shell-stop"    },
     { "status",  "cmd-status",   "uid-status",  "gid-status",
-                 "suid-status",  "sgid-status"                 } };
+                 "suid-status",  "sgid-status", "shell-status"  } };
 #define action_count (sizeof(action_names) / sizeof(*action_names))
 
+static struct rlimitname {
+    char *key;
+    int resource;
+} rlimit_names[] = {
+    { "rlimit-as",         RLIMIT_AS         },
+    { "rlimit-core",       RLIMIT_CORE       },
+    { "rlimit-cpu",        RLIMIT_CPU        },
+    { "rlimit-data",       RLIMIT_DATA       },
+    { "rlimit-fsize",      RLIMIT_FSIZE      },
+    { "rlimit-locks",      RLIMIT_LOCKS      },
+    { "rlimit-memlock",    RLIMIT_MEMLOCK    },
+    { "rlimit-msgqueue",   RLIMIT_MSGQUEUE   },
+    { "rlimit-nice",       RLIMIT_NICE       },
+    { "rlimit-nofile",     RLIMIT_NOFILE     },
+    { "rlimit-nproc",      RLIMIT_NPROC      },
+    { "rlimit-rss",        RLIMIT_RSS        },
+    { "rlimit-rtprio",     RLIMIT_RTPRIO     },
+    { "rlimit-rttime",     RLIMIT_RTTIME     },
+    { "rlimit-sigpending", RLIMIT_SIGPENDING },
+    { "rlimit-stack",      RLIMIT_STACK      } };
+#define rlimit_count (sizeof(rlimit_names) / sizeof(*rlimit_names))
+
+/* I/O scheduling classes (see ioprio_set(2)) */
+static char *ioprio_classes[] = { "none", "realtime", "best-effort", "idle" };
+#define IOPRIO_CLASS_SHIFT 13
+
+/* Characters that make a command require a shell to run */
+#define SHELL_METACHARS "|&;<>()$`\\\"'*?[#~\n"
+
 /* Create a new runtime configuration based on the given configuration file */
 struct config *config_new(struct conffile *file, int quiet) {
     struct config *ret = calloc(1, sizeof(struct config));
@@ -38,11 +86,18 @@ struct config *config_new(struct conffile *file, int quiet) {
         return NULL;
     }
     ret->jobs = jobqueue_new();
-    if (! ret->jobs) {
+    ret->starts = jobqueue_new();
+    ret->spawns = jobqueue_new();
+    if (! ret->jobs || ! ret->starts || ! ret->spawns) {
         if (! quiet) perror("Failed to allocate memory");
         goto error;
     }
     ret->socket = -1;
+    ret->notify = -1;
+    ret->spawner = -1;
+    ret->ratebucket.uid = -1;
+    ret->generation = (unsigned long long) (timestamp() * 1000);
+    ret->horizon = ret->generation;
     ret->conffile = file;
     if (config_update(ret, quiet) < 0) {
         ret->conffile = NULL;
@@ -66,11 +121,56 @@ void config_del(struct config *conf) {
         }
     }
     conf->socket = -1;
+    if (conf->notify != -1) {
+        int en = errno;
+        close(conf->notify);
+        if (conf->notifypath && unlink(conf->notifypath) == -1)
+            logerr(ERROR, "Failed to remove notification socket");
+        errno = en;
+    }
+    conf->notify = -1;
+    free(conf->notifypath);
+    conf->notifypath = NULL;
+    if (conf->statuspage)
+        statuspage_close(conf->statuspage, 1);
+    conf->statuspage = NULL;
+    free(conf->statuspath);
+    conf->statuspath = NULL;
     conf->flags = 0;
+    if (conf->spawner != -1) close(conf->spawner);
+    conf->spawner = -1;
+    if (conf->spawns) jobqueue_free(conf->spawns);
+    conf->spawns = NULL;
+    free(conf->cgrouproot);
+    conf->cgrouproot = NULL;
     if (conf->conffile) conffile_free(conf->conffile);
     conf->conffile = NULL;
     if (conf->jobs) jobqueue_free(conf->jobs);
     conf->jobs = NULL;
+    if (conf->starts) jobqueue_free(conf->starts);
+    conf->starts = NULL;
+    /* Only now that all jobs (and thus actions in progress) are gone */
+    while (conf->uidinflight) {
+        struct uidcount *next = conf->uidinflight->next;
+        free(conf->uidinflight);
+        conf->uidinflight = next;
+    }
+    conf->inflight = 0;
+    execcache_flush(&conf->execs);
+    if (conf->cpumap) cpumap_free(conf->cpumap);
+    conf->cpumap = NULL;
+    while (conf->buckets) {
+        struct bucket *next = conf->buckets->next;
+        free(conf->buckets);
+        conf->buckets = next;
+    }
+    while (conf->tombstones) {
+        struct tombstone *next = conf->tombstones->next;
+        free(conf->tombstones->name);
+        free(conf->tombstones);
+        conf->tombstones = next;
+    }
+    conf->tombcount = 0;
     if (conf->programs) prog_free(conf->programs);
     conf->programs = NULL;
 }
@@ -86,10 +186,12 @@ void config_free(struct config *conf) {
 int config_update(struct config *conf, int quiet) {
     struct pair *pair;
     struct section *sec;
-    struct program *prog, *nextprog;
+    struct program *prog, *nextprog, *newprogs = NULL, *lastprog = NULL;
     int ret = 0;
     /* No file present -> Nothing to do */
     if (! conf->conffile) return 0;
+    /* Executables might have changed as well */
+    execcache_flush(&conf->execs);
     /* Re-parse configuration file */
     if (conf->conffile->fp) {
         int lineno = -1;
@@ -123,6 +225,19 @@ int config_update(struct config *conf, int quiet) {
     conf->def_suid = -1;
     conf->def_sgid = -1;
     conf->autostart = 1;
+    conf->spawnhelper = 0;
+    conf->maxstarts = 0;
+    conf->settle = 1;
+    conf->shutdownmode = SHUTDOWN_LEAVE;
+    conf->shutdowntimeout = 30;
+    conf->ratelimit = 0;
+    conf->rateburst = 0;
+    conf->uidratelimit = 0;
+    conf->uidrateburst = 0;
+    conf->maxinflight = 0;
+    conf->uidmaxinflight = 0;
+    free(conf->cgrouproot);
+    conf->cgrouproot = NULL;
     /* Parse global members */
     sec = conffile_get_last(conf->conffile, NULL);
     if (sec) {
@@ -182,12 +297,123 @@ int config_update(struct config *conf, int quiet) {
             }
             conf->autostart = value;
         }
+        /* Spawner process */
+        pair = section_get_last(sec, "spawn-helper");
+        if (pair) {
+            if (! parse_int(&value, pair->value, INTKWD_YESNO)) {
+                if (! quiet) perror("Could not parse spawn-helper");
+                return -2;
+            }
+            conf->spawnhelper = value;
+        }
+        /* Start scheduling */
+        pair = section_get_last(sec, "max-concurrent-starts");
+        if (pair) {
+            if (! parse_int(&value, pair->value, 0)) {
+                if (! quiet) perror("Could not parse max-concurrent-starts");
+                return -2;
+            }
+            conf->maxstarts = (value < 0) ? 0 : value;
+        }
+        pair = section_get_last(sec, "start-settle");
+        if (pair) {
+            if (! parse_int(&value, pair->value, 0)) {
+                if (! quiet) perror("Could not parse start-settle");
+                return -2;
+            }
+            conf->settle = (value < 0) ? 0 : value;
+        }
+        /* Shutdown behavior */
+        pair = section_get_last(sec, "shutdown-mode");
+        if (pair) {
+            if (strcmp(pair->value, "leave") == 0) {
+                conf->shutdownmode = SHUTDOWN_LEAVE;
+            } else if (strcmp(pair->value, "stop") == 0) {
+                conf->shutdownmode = SHUTDOWN_STOP;
+            } else {
+                errno = EINVAL;
+                if (! quiet) perror("Could not parse shutdown-mode");
+                return -2;
+            }
+        }
+        pair = section_get_last(sec, "shutdown-timeout");
+        if (pair) {
+            if (! parse_int(&value, pair->value, 0)) {
+                if (! quiet) perror("Could not parse shutdown-timeout");
+                return -2;
+            }
+            conf->shutdowntimeout = (value < 0) ? 0 : value;
+        }
+        /* Admission control */
+        #define PARSE_RATE(key, member) \
+            pair = section_get_last(sec, key); \
+            if (pair) { \
+                if (! parse_double(&conf->member, pair->value)) { \
+                    if (! quiet) perror("Could not parse " key); \
+                    return -2; \
+                } \
+                if (conf->member < 0) conf->member = 0; \
+            }
+        PARSE_RATE("rate-limit", ratelimit)
+        PARSE_RATE("rate-burst", rateburst)
+        PARSE_RATE("uid-rate-limit", uidratelimit)
+        PARSE_RATE("uid-rate-burst", uidrateburst)
+        #undef PARSE_RATE
+        pair = section_get_last(sec, "max-inflight");
+        if (pair) {
+            if (! parse_int(&value, pair->value, 0)) {
+                if (! quiet) perror("Could not parse max-inflight");
+                return -2;
+            }
+            conf->maxinflight = (value < 0) ? 0 : value;
+        }
+        pair = section_get_last(sec, "uid-max-inflight");
+        if (pair) {
+            if (! parse_int(&value, pair->value, 0)) {
+                if (! quiet) perror("Could not parse uid-max-inflight");
+                return -2;
+            }
+            conf->uidmaxinflight = (value < 0) ? 0 : value;
+        }
+        /* Root cgroup for programs */
+        pair = section_get_last(sec, "cgroup-root");
+        if (pair) {
+            conf->cgrouproot = strdup(pair->value);
+            if (! conf->cgrouproot) {
+                if (! quiet) perror("Could not allocate string");
+                return -1;
+            }
+        }
     }
-    /* Mark all programs for removal (merged ones will have flag clear) */
-    for (prog = conf->programs; prog; prog = prog->next) {
-        prog->flags |= PROG_REMOVE;
+    /* Notification socket path (unless the socket is bound already) */
+    if (conf->notify == -1) {
+        free(conf->notifypath);
+        pair = (sec) ? section_get_last(sec, "notify-socket") : NULL;
+        if (pair) {
+            conf->notifypath = strdup(pair->value);
+        } else {
+            conf->notifypath = concat(conf->socketpath, ".notify");
+        }
+        if (! conf->notifypath) {
+            if (! quiet) perror("Could not allocate string");
+            return -1;
+        }
     }
-    /* Reload programs */
+    /* Status page path (likewise) */
+    if (! conf->statuspage) {
+        free(conf->statuspath);
+        conf->statuspath = NULL;
+        pair = (sec) ? section_get_last(sec, "status-page") : NULL;
+        if (pair) {
+            conf->statuspath = strdup(pair->value);
+            if (! conf->statuspath) {
+                if (! quiet) perror("Could not allocate string");
+                return -1;
+            }
+        }
+    }
+    /* Create the new programs aside, so that the running configuration is
+     * left alone if any of them is invalid */
     for (sec = conf->conffile->sections; sec; sec = sec->next) {
         /* Scroll to last section of "grop" */
         sec = section_last(sec);
@@ -200,32 +426,80 @@ int config_update(struct config *conf, int quiet) {
             if (! quiet)
                 fprintf(stderr, "Could not create program structure (%s): "
                     "%s\n", sec->name + 5, strerror(errno));
-            return -1;
+            ret = -1;
+            goto end;
         }
-        /* Merge with old one, if any */
-        config_add(conf, prog);
+        prog->prev = lastprog;
+        if (lastprog) {
+            lastprog->next = prog;
+        } else {
+            newprogs = prog;
+        }
+        lastprog = prog;
         ret++;
     }
-    /* Remove programs not present anymore */
+    /* Validate dependencies */
+    for (prog = newprogs; prog; prog = prog->next) {
+        if (! check_deps(newprogs, prog, quiet)) {
+            ret = -2;
+            break;
+        }
+    }
+    for (prog = newprogs; prog; prog = prog->next)
+        prog->flags &= ~(PROG_VISITING | PROG_VISITED);
+    if (ret < 0) goto end;
+    /* Mark all programs for removal (merged ones will have flag clear) */
+    for (prog = conf->programs; prog; prog = prog->next) {
+        prog->flags |= PROG_REMOVE;
+    }
+    /* Merge the new programs with the old ones, if any */
+    for (prog = newprogs; prog; prog = nextprog) {
+        nextprog = prog->next;
+        prog->prev = NULL;
+        prog->next = NULL;
+        config_add(conf, prog);
+    }
+    newprogs = NULL;
+    /* Remove programs not present (and not about to be running) anymore */
     for (prog = conf->programs; prog; prog = nextprog) {
         nextprog = prog->next;
-        if (! (prog->flags & PROG_REMOVE) || prog->pid) continue;
+        if (! (prog->flags & PROG_REMOVE) || prog->pid != -1 ||
+                prog->flags & PROG_SPAWNING)
+            continue;
         config_remove(conf, prog);
     }
     /* Done */
-    return ret;
+    end:
+        if (newprogs) {
+            int en = errno;
+            prog_free(newprogs);
+            errno = en;
+        }
+        if (ret == -2) errno = EINVAL;
+        return ret;
 }
 
 /* Add the given program to the configuration, merging the entries if
  * necessary */
 void config_add(struct config *conf, struct program *prog) {
     struct program *old, *prev = NULL;
+    struct tombstone **pt, *t;
     /* Find old location */
     for (old = conf->programs; old; prev = old, old = old->next) {
         if (strcmp(old->name, prog->name) == 0) break;
     }
     /* Add new entry */
     if (! old) {
+        /* A program that has come back is reported as changed instead */
+        for (pt = &conf->tombstones; *pt; pt = &(*pt)->next) {
+            if (strcmp((*pt)->name, prog->name) != 0) continue;
+            t = *pt;
+            *pt = t->next;
+            free(t->name);
+            free(t);
+            conf->tombcount--;
+            break;
+        }
         if (! prev) {
             conf->programs = prog;
             prog->prev = NULL;
@@ -242,9 +516,27 @@ void config_add(struct config *conf, struct program *prog) {
     prog->next = old->next;
     if (prog->prev) prog->prev->next = prog;
     if (prog->next) prog->next->prev = prog;
-    /* Migrate PID and flags */
+    /* Migrate PID, flags, CPU placement, and restart state */
     prog->flags = old->flags & ~PROG_REMOVE;
     prog->pid = old->pid;
+    prog->placed = old->placed;
+    prog->startgen = old->startgen;
+    prog->changed = old->changed;
+    prog->seenpid = old->seenpid;
+    prog->seenflags = old->seenflags;
+    prog->seenplaced = old->seenplaced;
+    prog->curdelay = old->curdelay;
+    prog->started = old->started;
+    prog->winstart = old->winstart;
+    prog->restarts = old->restarts;
+    prog->restartcount = old->restartcount;
+    prog->exitcode = old->exitcode;
+    prog->exited = old->exited;
+    prog->stopped = old->stopped;
+    prog->hstate = old->hstate;
+    prog->wdeadline = old->wdeadline;
+    prog->statusrun = old->statusrun;
+    old->statusrun = NULL;
     /* Deallocate old structure */
     old->prev = NULL;
     old->next = NULL;
@@ -272,17 +564,67 @@ struct program *config_getpid(struct config *conf, int pid) {
 
 /* Remove the given program from the configuration, deallocating it */
 void config_remove(struct config *conf, struct program *prog) {
+    struct tombstone *t, **pt;
+    /* Unlink it right away; jobs still holding references keep the
+     * structure alive, but must not see it in the list anymore */
     if (conf->programs == prog) conf->programs = prog->next;
+    if (prog->prev) prog->prev->next = prog->next;
+    if (prog->next) prog->next->prev = prog->prev;
+    prog->prev = NULL;
+    prog->next = NULL;
+    /* Leave a tombstone (if that fails, listings of changes since before
+     * now cannot be told anymore) */
+    t = malloc(sizeof(struct tombstone));
+    if (t) t->name = strdup(prog->name);
+    if (t && t->name) {
+        t->gen = ++conf->generation;
+        t->next = conf->tombstones;
+        conf->tombstones = t;
+        conf->tombcount++;
+    } else {
+        free(t);
+        conf->horizon = ++conf->generation;
+    }
+    /* Forget the oldest one if there are too many */
+    if (conf->tombcount > TOMBSTONE_MAX) {
+        for (pt = &conf->tombstones; (*pt)->next; pt = &(*pt)->next);
+        conf->horizon = (*pt)->gen;
+        free((*pt)->name);
+        free(*pt);
+        *pt = NULL;
+        conf->tombcount--;
+    }
     if (prog_del(prog)) free(prog);
 }
 
+/* Note which programs have changed their state since the last call */
+unsigned long long config_track(struct config *conf) {
+    struct program *prog;
+    int changed = 0;
+    for (prog = conf->programs; prog; prog = prog->next) {
+        int flags = prog->flags & PROG_TRACKED;
+        if (prog->changed && prog->pid == prog->seenpid &&
+                flags == prog->seenflags && (! (flags & PROG_PLACED) ||
+                CPU_EQUAL(&prog->placed, &prog->seenplaced)))
+            continue;
+        if (! changed) conf->generation++;
+        changed = 1;
+        prog->changed = conf->generation;
+        prog->seenpid = prog->pid;
+        prog->seenflags = flags;
+        prog->seenplaced = prog->placed;
+    }
+    return conf->generation;
+}
+
 /* Allocate a program using the configuration from the given configuration
  * section (which may be NULL) */
 struct program *prog_new(struct config *conf, struct section *config) {
     struct pair *pair;
     struct program *ret = calloc(1, sizeof(struct program));
     struct action *act = NULL;
-    int i, def_uid, def_gid, def_suid, def_sgid;
+    struct procattr attr;
+    int i, def_uid, def_gid, def_suid, def_sgid, cgroup = 1;
     /* Set name */
     if (! config->name) {
         ret->name = strdup("");
@@ -298,6 +640,11 @@ struct program *prog_new(struct config *conf, struct section *config) {
     def_suid = (! conf) ? -1 : conf->def_suid;
     def_sgid = (! conf) ? -1 : conf->def_sgid;
     ret->delay = -1;
+    ret->multiplier = 2;
+    ret->stable = 60;
+    ret->window = 60;
+    ret->limits.cpu_weight = -1;
+    ret->limits.io_weight = -1;
     /* Read configuration */
     if (config) {
         /* Update default UIDs and GIDs */
@@ -320,12 +667,186 @@ struct program *prog_new(struct config *conf, struct section *config) {
         pair = section_get_last(config, "autostart");
         if (pair && ! parse_int(&ret->autostart, pair->value, INTKWD_YESNO))
             goto error;
+        /* Set restart backoff and limits */
+        pair = section_get_last(config, "restart-delay-max");
+        if (pair && ! parse_int(&ret->delaymax, pair->value, INTKWD_NONE))
+            goto error;
+        pair = section_get_last(config, "restart-multiplier");
+        if (pair) {
+            if (! parse_double(&ret->multiplier, pair->value)) goto error;
+            if (ret->multiplier < 1) {
+                errno = EINVAL;
+                goto error;
+            }
+        }
+        pair = section_get_last(config, "restart-jitter");
+        if (pair) {
+            if (! parse_double(&ret->jitter, pair->value)) goto error;
+            if (ret->jitter < 0 || ret->jitter > 1) {
+                errno = EINVAL;
+                goto error;
+            }
+        }
+        pair = section_get_last(config, "restart-reset");
+        if (pair && ! parse_int(&ret->stable, pair->value, 0))
+            goto error;
+        pair = section_get_last(config, "restart-limit");
+        if (pair && ! parse_int(&ret->limit, pair->value, INTKWD_NONE))
+            goto error;
+        pair = section_get_last(config, "restart-window");
+        if (pair) {
+            if (! parse_int(&ret->window, pair->value, 0)) goto error;
+            if (ret->window <= 0) {
+                errno = EINVAL;
+                goto error;
+            }
+        }
+        pair = section_get_last(config, "start-priority");
+        if (pair && ! parse_int(&ret->priority, pair->value, 0))
+            goto error;
+        /* Set dependencies */
+        pair = section_get_last(config, "requires");
+        if (pair) {
+            ret->requires = split_command(pair->value);
+            if (! ret->requires) goto error;
+        }
+        pair = section_get_last(config, "after");
+        if (pair) {
+            ret->after = split_command(pair->value);
+            if (! ret->after) goto error;
+        }
+        /* Set readiness notification */
+        pair = section_get_last(config, "notify");
+        if (pair && ! parse_int(&ret->notify, pair->value, INTKWD_YESNO))
+            goto error;
+        pair = section_get_last(config, "start-timeout");
+        if (pair) {
+            if (! parse_int(&ret->timeout, pair->value, 0)) goto error;
+            if (ret->timeout < 0) ret->timeout = 0;
+        }
+        /* Set stopping behavior */
+        pair = section_get_last(config, "stop-timeout");
+        if (pair) {
+            if (! parse_int(&ret->stoptimeout, pair->value, 0)) goto error;
+            if (ret->stoptimeout < 0) ret->stoptimeout = 0;
+        }
+        pair = section_get_last(config, "kill-mode");
+        if (pair) {
+            if (strcmp(pair->value, "process") == 0) {
+                ret->killmode = KILL_PROCESS;
+            } else if (strcmp(pair->value, "group") == 0) {
+                ret->killmode = KILL_GROUP;
+            } else if (strcmp(pair->value, "cgroup") == 0) {
+                ret->killmode = KILL_CGROUP;
+            } else {
+                errno = EINVAL;
+                goto error;
+            }
+        }
+        /* Set health check */
+        pair = section_get_last(config, "health-check");
+        if (pair) {
+            ret->health = health_parse(pair->value);
+            if (! ret->health) goto error;
+            pair = section_get_last(config, "health-interval");
+            if (pair) {
+                if (! parse_int(&ret->health->interval, pair->value, 0))
+                    goto error;
+                if (ret->health->interval <= 0) {
+                    errno = EINVAL;
+                    goto error;
+                }
+            }
+            pair = section_get_last(config, "health-timeout");
+            if (pair) {
+                if (! parse_int(&ret->health->timeout, pair->value, 0))
+                    goto error;
+                if (ret->health->timeout <= 0) {
+                    errno = EINVAL;
+                    goto error;
+                }
+            }
+            pair = section_get_last(config, "health-threshold");
+            if (pair) {
+                if (! parse_int(&ret->health->threshold, pair->value, 0))
+                    goto error;
+                if (ret->health->threshold <= 0) {
+                    errno = EINVAL;
+                    goto error;
+                }
+            }
+            /* Run the command of an exec check directly if possible */
+            if (ret->health->type == HEALTH_EXEC &&
+                    ! tokenize_command(ret->health->target, SHELL_AUTO,
+                                       &ret->health->execpath,
+                                       &ret->health->execargv))
+                goto error;
+        }
+        /* Set watchdog */
+        pair = section_get_last(config, "watchdog-interval");
+        if (pair) {
+            if (! parse_int(&ret->watchdog, pair->value, 0)) goto error;
+            if (ret->watchdog < 0) ret->watchdog = 0;
+        }
+        /* Set status caching */
+        pair = section_get_last(config, "status-cache-ms");
+        if (pair) {
+            if (! parse_int(&ret->statuscache, pair->value, 0)) goto error;
+            if (ret->statuscache < 0) ret->statuscache = 0;
+        }
         /* Set CWD */
         pair = section_get_last(config, "cwd");
         if (pair) {
             ret->cwd = strdup(pair->value);
             if (! ret->cwd) goto error;
         }
+        /* Set cgroup and resource limits */
+        pair = section_get_last(config, "cgroup");
+        if (pair && ! parse_int(&cgroup, pair->value, INTKWD_YESNO))
+            goto error;
+        pair = section_get_last(config, "memory-max");
+        if (pair) {
+            if (! cgroup_check_memory(pair->value)) goto error;
+            ret->limits.memory_max = strdup(pair->value);
+            if (! ret->limits.memory_max) goto error;
+        }
+        pair = section_get_last(config, "cpu-weight");
+        if (pair && ! parse_weight(&ret->limits.cpu_weight, pair->value))
+            goto error;
+        pair = section_get_last(config, "io-weight");
+        if (pair && ! parse_weight(&ret->limits.io_weight, pair->value))
+            goto error;
+        /* Set scheduling attributes and resource limits */
+        if (! parse_procattr(&attr, config)) goto error;
+        if (attr.flags || attr.rlimset) {
+            ret->attr = malloc(sizeof(struct procattr));
+            if (! ret->attr) goto error;
+            memcpy(ret->attr, &attr, sizeof(struct procattr));
+        }
+        /* Set automatic CPU placement */
+        pair = section_get_last(config, "cpu-placement");
+        if (pair) {
+            if (strcmp(pair->value, "auto") == 0) {
+                ret->cpucount = 1;
+            } else if (strcmp(pair->value, "none") != 0) {
+                errno = EINVAL;
+                goto error;
+            }
+        }
+        pair = section_get_last(config, "cpu-count");
+        if (pair && ret->cpucount) {
+            if (! parse_int(&ret->cpucount, pair->value, 0)) goto error;
+            if (ret->cpucount < 1) {
+                errno = EINVAL;
+                goto error;
+            }
+        }
+    }
+    if (cgroup && conf && conf->cgrouproot) {
+        ret->cgroup = malloc(strlen(conf->cgrouproot) +
+                             strlen(ret->name) + 2);
+        if (! ret->cgroup) goto error;
+        sprintf(ret->cgroup, "%s/%s", conf->cgrouproot, ret->name);
     }
     /* Initialize actions */
     for (i = 0; i < action_count; i++) {
@@ -335,6 +856,7 @@ struct program *prog_new(struct config *conf, struct section *config) {
             act = calloc(1, sizeof(struct action));
             if (! act) goto error;
             act->name = action_names[i].base;
+            act->shell = SHELL_AUTO;
             if (pair) {
                 act->command = strdup(pair->value);
                 if (! act->command) goto error;
@@ -362,6 +884,14 @@ struct program *prog_new(struct config *conf, struct section *config) {
             if (pair && ! parse_int(&act->sgid, pair->value,
                                     INTKWD_NONE))
                 goto error;
+            /* Determine whether to run the command directly */
+            pair = section_get_last(config, action_names[i].shell);
+            if (pair && ! parse_shell(&act->shell, pair->value))
+                goto error;
+            if (! tokenize_command(act->command, act->shell, &act->execpath,
+                                   &act->execargv))
+                goto error;
+            if (! action_prepare(conf, ret, act)) goto error;
         }
         /* Insert into structure */
         *action_pointer(ret, action_names[i].base) = act;
@@ -369,6 +899,8 @@ struct program *prog_new(struct config *conf, struct section *config) {
     /* Set miscellaneous variables */
     ret->refcount = 1;
     ret->pid = -1;
+    ret->hstate.pid = -1;
+    ret->hstate.fd = -1;
     /* Done */
     goto end;
     error:
@@ -389,6 +921,21 @@ int prog_del(struct program *prog) {
     prog->delay = -1;
     free(prog->cwd);
     prog->cwd = NULL;
+    free(prog->cgroup);
+    prog->cgroup = NULL;
+    free(prog->limits.memory_max);
+    prog->limits.memory_max = NULL;
+    free(prog->attr);
+    prog->attr = NULL;
+    if (prog->requires) free_strings(prog->requires);
+    prog->requires = NULL;
+    if (prog->after) free_strings(prog->after);
+    prog->after = NULL;
+    health_free(prog->health);
+    prog->health = NULL;
+    if (prog->statusrun && statusrun_del(prog->statusrun))
+        free(prog->statusrun);
+    prog->statusrun = NULL;
     if (prog->prev) prog->prev->next = prog->next;
     if (prog->next) prog->next->prev = prog->prev;
     prog->prev = NULL;
@@ -422,6 +969,44 @@ struct action *prog_action(struct program *prog, char *name) {
     return (ptr) ? *ptr : NULL;
 }
 
+/* Allocate a status command execution with a fresh memory file */
+struct statusrun *statusrun_new(void) {
+    struct statusrun *ret = calloc(1, sizeof(struct statusrun));
+    if (! ret) return NULL;
+    ret->refcount = 1;
+    ret->pid = -1;
+    ret->fd = memfd_create("procmgr-status", MFD_CLOEXEC);
+    if (ret->fd == -1) {
+        free(ret);
+        return NULL;
+    }
+    return ret;
+}
+
+/* Free all the resources underlying the given structure */
+int statusrun_del(struct statusrun *run) {
+    if (--run->refcount > 0) return 0;
+    if (run->fd != -1) close(run->fd);
+    run->fd = -1;
+    free(run->output);
+    run->output = NULL;
+    return 1;
+}
+
+/* Describe the state of prog as a space-separated list of tokens */
+char *prog_state(struct program *prog, char *buf, int size) {
+    int running = (prog->pid != -1);
+    snprintf(buf, size, "%s%s%s%s%s", (running) ? "running" : "dead",
+             (running && prog->flags & PROG_STARTING) ? " starting" :
+             (! running && prog->flags & PROG_SPAWNING) ? " spawning" :
+             (! running && prog->flags & PROG_QUEUED) ? " queued" : "",
+             (prog->flags & PROG_QUARANTINED) ? " quarantined" : "",
+             (prog->flags & PROG_REMOVE) ? " lingering" : "",
+             (prog->flags & PROG_REMOVE && ! running &&
+              ! (prog->flags & (PROG_QUEUED | PROG_SPAWNING))) ? " ?!" : "");
+    return buf;
+}
+
 /* Get a pointer to the struct action corresponding to the name, or NULL if
  * none */
 struct action **action_pointer(struct program *prog, char *name) {
@@ -446,6 +1031,390 @@ struct action **action_pointer(struct program *prog, char *name) {
 void action_free(struct action **act) {
     if (! *act) return;
     if ((*act)->command) free((*act)->command);
+    free((*act)->execpath);
+    if ((*act)->execargv) free_strings((*act)->execargv);
+    if ((*act)->execenvp) {
+        /* The PID entry is not owned by the action */
+        (*act)->execenvp[(*act)->envpid] = NULL;
+        free_strings((*act)->execenvp);
+    }
     free(*act);
     *act = NULL;
 }
+
+/* Prepare the given command (which may be NULL) for being run without a
+ * shell, if desired (according to shell, one of the SHELL_* constants) and
+ * possible
+ * If so, *path and *argv receive the executable and the argument vector;
+ * otherwise, they are left alone.
+ * Returns zero on error (with errno set), or nonzero otherwise. */
+int tokenize_command(char *command, int shell, char **path, char ***argv) {
+    char **words, *exe;
+    if (! command || shell == SHELL_ALWAYS) return 1;
+    /* Commands that need a shell are not candidates for automatic mode */
+    if (shell == SHELL_AUTO && strpbrk(command, SHELL_METACHARS))
+        return 1;
+    words = split_command(command);
+    if (! words) return 0;
+    /* An exec with options (such as -a) can only be performed by the
+     * shell, regardless of the mode */
+    if (words[0] && strcmp(words[0], "exec") == 0 && words[1] &&
+            words[1][0] == '-') {
+        free_strings(words);
+        return 1;
+    }
+    /* Strip a leading exec (which has no effect without a shell) */
+    if (words[0] && strcmp(words[0], "exec") == 0 && words[1]) {
+        char **p;
+        free(words[0]);
+        for (p = words; *p; p++) p[0] = p[1];
+    }
+    /* Leave empty commands, variable assignments, and builtins to the
+     * shell in automatic mode */
+    if (shell == SHELL_AUTO && (! words[0] ||
+            strcmp(words[0], "exec") == 0 || strchr(words[0], '='))) {
+        free_strings(words);
+        return 1;
+    }
+    if (! words[0]) {
+        free_strings(words);
+        errno = EINVAL;
+        return 0;
+    }
+    /* Locate executable */
+    exe = resolve_command(words[0]);
+    if (! exe) {
+        if (errno != ENOENT) {
+            free_strings(words);
+            return 0;
+        } else if (shell == SHELL_AUTO) {
+            /* Possibly a shell builtin */
+            free_strings(words);
+            return 1;
+        }
+        /* Let execve() report the error at runtime */
+        exe = strdup(words[0]);
+        if (! exe) {
+            free_strings(words);
+            return 0;
+        }
+    }
+    *path = exe;
+    *argv = words;
+    return 1;
+}
+
+/* Assemble the static parts of the argument vector and the environment of
+ * the given action
+ * Returns zero on error (with errno set), or nonzero otherwise. */
+int action_prepare(struct config *conf, struct program *prog,
+                   struct action *act) {
+    char **p;
+    int i, notify;
+    if (! act->command) return 1;
+    /* Only the main process of the program may report readiness or send
+     * keepalive messages */
+    notify = ((prog->notify || prog->watchdog) && conf && conf->notifypath &&
+              (strcmp(act->name, "start") == 0 ||
+               strcmp(act->name, "restart") == 0));
+    /* Argument vector */
+    if (act->execargv) {
+        act->passargs = (act->shell == SHELL_NEVER);
+    } else {
+        act->execpath = strdup(ACTION_SHELL);
+        if (! act->execpath) return 0;
+        act->execargv = calloc(4, sizeof(char *));
+        if (! act->execargv) return 0;
+        act->execargv[0] = strdup(ACTION_SHELL);
+        act->execargv[1] = strdup("-c");
+        act->execargv[2] = strdup(act->command);
+        for (i = 0; i < 3; i++) {
+            if (! act->execargv[i]) return 0;
+        }
+        act->passargs = 1;
+    }
+    for (p = act->execargv; *p; p++) act->execargc++;
+    /* Environment; the PID goes last, and is filled in for each request */
+    act->envpid = 4;
+    if (notify) act->envpid += (prog->watchdog) ? 2 : 1;
+    act->execenvp = calloc(act->envpid + 2, sizeof(char *));
+    if (! act->execenvp) return 0;
+    act->execenvp[0] = strdup("PATH=" ACTION_PATH);
+    if (! act->execenvp[0]) return 0;
+    act->execenvp[1] = strdup("SHELL=" ACTION_SHELL);
+    if (! act->execenvp[1]) return 0;
+    act->execenvp[2] = concat("PROGNAME=", prog->name);
+    if (! act->execenvp[2]) return 0;
+    act->execenvp[3] = concat("ACTION=", act->name);
+    if (! act->execenvp[3]) return 0;
+    if (notify) {
+        act->execenvp[4] = concat("NOTIFY_SOCKET=", conf->notifypath);
+        if (! act->execenvp[4]) return 0;
+    }
+    if (notify && prog->watchdog) {
+        char buf[64];
+        snprintf(buf, sizeof(buf), "WATCHDOG_USEC=%lld",
+                 prog->watchdog * 1000000LL);
+        act->execenvp[5] = strdup(buf);
+        if (! act->execenvp[5]) return 0;
+    }
+    act->execenvp[act->envpid] = "PID=";
+    return 1;
+}
+
+/* Parse a value of a shell-* setting */
+int parse_shell(int *ret, char *value) {
+    int res;
+    if (strcmp(value, "auto") == 0) {
+        *ret = SHELL_AUTO;
+        return 1;
+    }
+    if (! parse_int(&res, value, INTKWD_YESNO)) return 0;
+    *ret = (res) ? SHELL_ALWAYS : SHELL_NEVER;
+    return 1;
+}
+
+/* Check that the dependencies of prog exist in list and do not form cycles
+ * Programs are marked as visited by depth-first search; the caller must
+ * clear the marks afterwards. Returns nonzero if everything is fine, or
+ * zero (having written a message to stderr if quiet is false) otherwise. */
+int check_deps(struct program *list, struct program *prog, int quiet) {
+    struct program *dep;
+    char **lists[2] = { prog->requires, prog->after }, **p;
+    int i;
+    if (prog->flags & PROG_VISITED) return 1;
+    if (prog->flags & PROG_VISITING) {
+        if (! quiet)
+            fprintf(stderr, "Dependency cycle involving program '%s'\n",
+                    prog->name);
+        return 0;
+    }
+    prog->flags |= PROG_VISITING;
+    for (i = 0; i < 2; i++) {
+        if (! lists[i]) continue;
+        for (p = lists[i]; *p; p++) {
+            for (dep = list; dep; dep = dep->next) {
+                if (strcmp(dep->name, *p) == 0) break;
+            }
+            if (! dep) {
+                /* Only required programs must exist */
+                if (i == 1) continue;
+                if (! quiet)
+                    fprintf(stderr, "Program '%s' requires unknown program "
+                        "'%s'\n", prog->name, *p);
+                return 0;
+            }
+            if (! check_deps(list, dep, quiet)) return 0;
+        }
+    }
+    prog->flags &= ~PROG_VISITING;
+    prog->flags |= PROG_VISITED;
+    return 1;
+}
+
+/* Parse a cgroup weight */
+int parse_weight(int *ret, char *value) {
+    if (! parse_int(ret, value, 0)) return 0;
+    if (*ret < 1 || *ret > 10000) {
+        errno = EINVAL;
+        return 0;
+    }
+    return 1;
+}
+
+/* Parse the scheduling attributes and resource limits from the given
+ * configuration section */
+int parse_procattr(struct procattr *attr, struct section *config) {
+    struct pair *pair;
+    int i;
+    memset(attr, 0, sizeof(struct procattr));
+    pair = section_get_last(config, "cpus");
+    if (pair) {
+        if (! cpuset_parse(&attr->cpus, pair->value)) return 0;
+        attr->flags |= PROCATTR_CPUS;
+    }
+    pair = section_get_last(config, "nice");
+    if (pair) {
+        if (! parse_int(&attr->nice, pair->value, 0)) return 0;
+        if (attr->nice < -20 || attr->nice > 19) goto inval;
+        attr->flags |= PROCATTR_NICE;
+    }
+    pair = section_get_last(config, "ioprio");
+    if (pair) {
+        if (! parse_ioprio(&attr->ioprio, pair->value)) return 0;
+        attr->flags |= PROCATTR_IOPRIO;
+    }
+    pair = section_get_last(config, "oom-score-adj");
+    if (pair) {
+        if (! parse_int(&attr->oomadj, pair->value, 0)) return 0;
+        if (attr->oomadj < -1000 || attr->oomadj > 1000) goto inval;
+        attr->flags |= PROCATTR_OOMADJ;
+    }
+    for (i = 0; i < rlimit_count; i++) {
+        int res = rlimit_names[i].resource;
+        pair = section_get_last(config, rlimit_names[i].key);
+        if (! pair) continue;
+        if (! parse_rlimit(&attr->rlimits[res], pair->value)) return 0;
+        attr->rlimset |= 1 << res;
+    }
+    return 1;
+    inval:
+        errno = EINVAL;
+        return 0;
+}
+
+/* Parse an I/O priority, like "best-effort:4" */
+int parse_ioprio(int *ret, char *value) {
+    char *sep = strchr(value, ':');
+    int i, cls = -1, level = 4, len;
+    len = (sep) ? sep - value : strlen(value);
+    for (i = 1; i < sizeof(ioprio_classes) / sizeof(*ioprio_classes); i++) {
+        if (strncmp(value, ioprio_classes[i], len) == 0 &&
+                ! ioprio_classes[i][len]) {
+            cls = i;
+            break;
+        }
+    }
+    if (cls == -1) goto inval;
+    if (sep && ! parse_int(&level, sep + 1, 0)) return 0;
+    if (level < 0 || level > 7) goto inval;
+    /* The idle class has no levels */
+    if (strcmp(ioprio_classes[cls], "idle") == 0) level = 0;
+    *ret = cls << IOPRIO_CLASS_SHIFT | level;
+    return 1;
+    inval:
+        errno = EINVAL;
+        return 0;
+}
+
+/* Parse a resource limit, like "1024" or "1024:4096" (soft and hard) */
+int parse_rlimit(struct rlimit *ret, char *value) {
+    char *sep = strchr(value, ':');
+    int ok;
+    if (sep) *sep = '\0';
+    ok = parse_rlim(&ret->rlim_cur, value);
+    if (sep) *sep = ':';
+    if (! ok) return 0;
+    if (! sep) {
+        ret->rlim_max = ret->rlim_cur;
+        return 1;
+    }
+    if (! parse_rlim(&ret->rlim_max, sep + 1)) return 0;
+    /* RLIM_INFINITY is the largest value */
+    if (ret->rlim_cur > ret->rlim_max) {
+        errno = EINVAL;
+        return 0;
+    }
+    return 1;
+}
+
+/* Parse a single resource limit value, allowing "infinity" */
+int parse_rlim(rlim_t *ret, char *value) {
+    char *end;
+    if (strcmp(value, "infinity") == 0 || strcmp(value, "unlimited") == 0) {
+        *ret = RLIM_INFINITY;
+        return 1;
+    }
+    if (! isdigit(*value)) {
+        errno = EINVAL;
+        return 0;
+    }
+    errno = 0;
+    *ret = strtoull(value, &end, 10);
+    if (errno) return 0;
+    if (*end) {
+        errno = EINVAL;
+        return 0;
+    }
+    return 1;
+}
+
+/* Split a command into words, honoring quotes and backslash escapes (but
+ * performing no expansions)
+ * Returns a dynamically allocated NULL-terminated array of dynamically
+ * allocated strings, or NULL on error (with errno set; EINVAL indicates
+ * unbalanced quotes). */
+char **split_command(char *command) {
+    char **ret, *word, *out, *p = command;
+    int n = 0, quote;
+    ret = calloc(strlen(command) / 2 + 2, sizeof(char *));
+    word = malloc(strlen(command) + 1);
+    if (! ret || ! word) goto error;
+    for (;;) {
+        /* Skip whitespace */
+        while (isspace(*p)) p++;
+        if (! *p) break;
+        /* Copy word */
+        out = word;
+        quote = 0;
+        while (*p && (quote || ! isspace(*p))) {
+            if (quote != '\'' && *p == '\\' && p[1]) {
+                *out++ = p[1];
+                p += 2;
+            } else if (! quote && (*p == '\'' || *p == '"')) {
+                quote = *p++;
+            } else if (quote && *p == quote) {
+                quote = 0;
+                p++;
+            } else {
+                *out++ = *p++;
+            }
+        }
+        if (quote) {
+            errno = EINVAL;
+            goto error;
+        }
+        *out = '\0';
+        ret[n] = strdup(word);
+        if (! ret[n++]) goto error;
+    }
+    free(word);
+    return ret;
+    error:
+        free(word);
+        if (ret) free_strings(ret);
+        return NULL;
+}
+
+/* Look up the given command name in ACTION_PATH (unless it contains a
+ * slash, in which case it is only checked)
+ * Returns a dynamically allocated path, or NULL on error (with errno set to
+ * ENOENT if the command was not found, or is not an executable regular
+ * file). */
+char *resolve_command(char *name) {
+    char *dir = ACTION_PATH, *end, *ret;
+    int nl = strlen(name);
+    struct stat st;
+    if (strchr(name, '/')) {
+        if (stat(name, &st) == 0 && S_ISREG(st.st_mode) &&
+                access(name, X_OK) == 0)
+            return strdup(name);
+        errno = ENOENT;
+        return NULL;
+    }
+    for (;;) {
+        int dl;
+        end = strchr(dir, ':');
+        dl = (end) ? end - dir : strlen(dir);
+        ret = malloc(dl + nl + 2);
+        if (! ret) return NULL;
+        memcpy(ret, dir, dl);
+        ret[dl] = '/';
+        memcpy(ret + dl + 1, name, nl + 1);
+        if (stat(ret, &st) == 0 && S_ISREG(st.st_mode) &&
+                access(ret, X_OK) == 0)
+            return ret;
+        free(ret);
+        if (! end) break;
+        dir = end + 1;
+    }
+    errno = ENOENT;
+    return NULL;
+}
+
+/* Free a NULL-terminated array of strings, as well as the strings */
+void free_strings(char **list) {
+    char **p;
+    for (p = list; *p; p++) free(*p);
+    free(list);
+}
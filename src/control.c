@@ -2,8 +2,8 @@
  * https://github.com/CylonicRaider/procmgr */
 
 #define _GNU_SOURCE
-#include <dirent.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <math.h>
 #include <signal.h>
 #include <stdio.h>
@@ -11,26 +11,96 @@
 #include <sys/types.h>
 
 #include "control.h"
+#include "launch.h"
+#include "logging.h"
+#include "util.h"
 
 /* Static definitions */
 struct waiter {
+    struct config *config;
     int fd;
     int pid;
+    struct program *program;
+    struct action *action;
+    int plain;
+    int uid;
     struct addr replyto;
     int flags;
+    int stop;
+    int killed;
+};
+struct reader {
+    struct config *config;
+    int fd;
+    int uid;
+    struct addr replyto;
+    int flags;
+    struct statusrun *run;
+};
+struct settler {
+    struct config *config;
+    struct program *program;
+    int startgen;
+    int notify;
+    int uid;
+    struct addr replyto;
+    int flags;
+    struct follower *followers;
 };
 
 static char *action_names[] = { "start", "restart", "reload", "signal",
     "stop", "status" };
 #define action_count (sizeof(action_names) / sizeof(*action_names))
-static int setup_fds(struct request *request);
+static int fill_bucket(struct bucket *bucket, double rate, double burst,
+                       double now);
+static int count_inflight(struct config *config, int uid);
+static int track_inflight(struct config *config, int uid, int delta);
+static int request_launch(struct request *request, struct launch *l,
+                          int remote);
+static int finish_launch(struct request *request, int ret);
+static int defer_launch(struct request *request);
+static int finish_spawn(struct request *request, int pid);
+static int fail_cgroup(struct request *request);
+static int drop_spawner(struct config *config);
+static void rebind_request(struct request *request);
+static int follow_request(struct request *request);
+static struct request *find_leader(struct request *request);
+static struct job *find_waiter(struct request *request);
+static int same_args(char **a, char **b);
+static void free_followers(struct follower *list);
+static int pull_deps(struct request *request);
+static int deps_state(struct config *config, struct program *prog);
+static int defer_start(struct request *request);
+static void cancel_start(struct config *config, struct program *prog);
+static int begin_start(struct request *request);
+static struct program *notify_sender(struct config *config, int pid);
+static int arm_killer(struct config *config, struct program *prog);
+static int arm_watchdog(struct config *config, struct program *prog,
+                        int startgen);
+static int has_dependents(struct config *config, struct program *prog);
 static int request_senderr(struct request *request, char *code, char *desc);
 static int request_reply(int fd, struct addr *addr, int flags, int code);
+static int reply_all(int fd, struct addr *addr, int flags,
+                     struct follower *followers, int code);
+static int senderr_all(int fd, struct addr *addr, int flags,
+                       struct follower *followers, char *code, char *desc);
+static int reply_status(struct request *request);
+static int status_lookup(struct request *request);
+static int reply_output(int fd, struct addr *addr, int flags,
+                        struct statusrun *run);
+static struct job *submit_reader(struct request *request,
+                                 struct statusrun *run);
 static struct job *submit_waiter(struct request *request, int pid);
 static int _run_waiter(void *data, int retcode);
+static void _free_waiter(void *data);
+static int _run_reader(void *data, int retcode);
+static void _free_reader(void *data);
+static int _run_settler(void *data, int retcode);
+static int _run_killer(void *data, int retcode);
+static int _run_watchdog(void *data, int retcode);
+static void _free_settler(void *data);
 static int _run_request(void *data, int retcode);
 static void _free_request(void *data);
-static char *concat(char *s1, char *s2);
 
 /* Duplicate a file descriptor or no file descriptor, returning whether
  * successful */
@@ -39,11 +109,60 @@ static inline int dupfd(int from, int *to) {
         *to = -1;
         return 1;
     } else {
-        *to = dup(from);
+        *to = fcntl(from, F_DUPFD_CLOEXEC, 0);
         return (*to != -1);
     }
 }
 
+/* Decide whether to admit a request from the given UID */
+int request_admit(struct config *config, int uid, char **reason) {
+    struct bucket *bucket = NULL, *cur, **pcur;
+    double now = timestamp();
+    if (uid == 0) return 1;
+    /* Limits on actions in progress */
+    if ((config->maxinflight && config->inflight >= config->maxinflight) ||
+            (config->uidmaxinflight &&
+             count_inflight(config, uid) >= config->uidmaxinflight)) {
+        *reason = "Too many actions in progress";
+        return 0;
+    }
+    /* Locate the bucket of the UID, discarding full ones on the way */
+    if (config->uidratelimit) {
+        for (pcur = &config->buckets; *pcur; ) {
+            cur = *pcur;
+            if (fill_bucket(cur, config->uidratelimit, config->uidrateburst,
+                            now) && cur->uid != uid) {
+                *pcur = cur->next;
+                free(cur);
+                continue;
+            }
+            if (cur->uid == uid) bucket = cur;
+            pcur = &cur->next;
+        }
+        if (! bucket) {
+            bucket = calloc(1, sizeof(struct bucket));
+            if (! bucket) return -1;
+            bucket->uid = uid;
+            fill_bucket(bucket, config->uidratelimit, config->uidrateburst,
+                        now);
+            bucket->next = config->buckets;
+            config->buckets = bucket;
+        }
+    }
+    /* Rate limits */
+    if (config->ratelimit)
+        fill_bucket(&config->ratebucket, config->ratelimit,
+                    config->rateburst, now);
+    if ((bucket && bucket->tokens < 1) ||
+            (config->ratelimit && config->ratebucket.tokens < 1)) {
+        *reason = "Too many requests";
+        return 0;
+    }
+    if (bucket) bucket->tokens--;
+    if (config->ratelimit) config->ratebucket.tokens--;
+    return 1;
+}
+
 /* Create a request from the given message */
 struct request *request_new(struct config *config, struct ctlmsg *msg,
                             struct addr *addr, int flags) {
@@ -52,6 +171,7 @@ struct request *request_new(struct config *config, struct ctlmsg *msg,
     struct request *ret = calloc(1, sizeof(struct request));
     if (ret == NULL) return NULL;
     ret->fds[0] = ret->fds[1] = ret->fds[2] = -1;
+    ret->creds.uid = -1;
     /* Check field amount */
     if (msg->fieldnum < 3) {
         if (comm_senderr(config->socket, "NOPARAMS", "Missing parameters",
@@ -80,6 +200,7 @@ struct request *request_new(struct config *config, struct ctlmsg *msg,
         if (! d) goto error;
         ret->argv[i - 3] = d;
     }
+    if (track_inflight(config, msg->creds.uid, 1) == -1) goto error;
     ret->creds = msg->creds;
     ret->fds[0] = msg->fds[0];
     ret->fds[1] = msg->fds[1];
@@ -168,22 +289,39 @@ struct job *request_schedule(struct request *request, double notBefore) {
 /* Perform the given action */
 int request_run(struct request *request) {
     struct program *prog = request->program;
+    struct config *config = request->config;
     struct request *req = NULL;
     struct job *job;
-    int ret = 0;
+    int ret = 0, starting, caching, deps, res;
     /* Discard request if necessary */
     if (prog->flags & PROG_RUNNING) {
         if (request->flags & REQUEST_DIHTR) return 0;
     } else {
         if (request->flags & REQUEST_DIHNTR) return 0;
     }
+    /* Attach to an identical request in progress */
+    res = follow_request(request);
+    if (res != 1) return res;
     /* Check for state validity */
+    if (prog->flags & PROG_SPAWNING && request->action != prog->act_status) {
+        return (request_senderr(request, "BUSY",
+                                "Program being spawned")) ? 0 : -1;
+    }
     if (prog->pid != -1) {
         if (request->action == prog->act_start) {
             return (request_senderr(request, "BUSY",
                                     "Program already running")) ? 0 : -1;
         }
     } else {
+        if (request->action == prog->act_stop && prog->flags & PROG_QUEUED) {
+            /* Stopping a program that has not started yet */
+            cancel_start(config, prog);
+            if (! (request->flags & REQUEST_NOFLAGS))
+                prog->flags &= ~PROG_RUNNING;
+            if (request->flags & REQUEST_NOREPLY) return 0;
+            return (request_reply(config->socket, &request->addr,
+                                  request->cflags, 0)) ? 0 : -1;
+        }
         if (request->action == prog->act_restart ||
                 request->action == prog->act_reload ||
                 request->action == prog->act_stop) {
@@ -191,15 +329,56 @@ int request_run(struct request *request) {
                                     "No program running")) ? 0 : -1;
         }
     }
+    /* Queue starts if too many are in progress already */
+    starting = ((request->action == prog->act_start ||
+                 request->action == prog->act_restart) &&
+                request->action->command);
+    if (starting) {
+        if (config->shutdown) {
+            return (request_senderr(request, "SHUTDOWN",
+                                    "Shutting down")) ? 0 : -1;
+        }
+        if (prog->flags & PROG_QUEUED) {
+            return (request_senderr(request, "BUSY",
+                                    "Program start already pending")) ? 0 : -1;
+        }
+        if (pull_deps(request) == -1) return -1;
+        deps = deps_state(config, prog);
+        if (deps == -1) {
+            return (request_senderr(request, "DEPENDENCY",
+                                    "Required program not running")) ? 0 : -1;
+        }
+        if (deps == 0 || config->holdstarts || (config->maxstarts &&
+                config->starting >= config->maxstarts))
+            return defer_start(request);
+    }
     /* Update flags */
     if (! (request->flags & REQUEST_NOFLAGS)) {
         if (request->action == prog->act_start ||
                 request->action == prog->act_restart) {
+            /* An explicit start lifts a quarantine and resets the
+             * backoff */
+            if (! (request->flags & REQUEST_DIHNTR)) {
+                prog->flags &= ~PROG_QUARANTINED;
+                prog->curdelay = 0;
+                prog->restarts = 0;
+            }
             prog->flags |= PROG_RUNNING;
         } else if (request->action == prog->act_stop) {
             prog->flags &= ~PROG_RUNNING;
         }
     }
+    /* Coalesce status requests onto running or recent executions of the
+     * status command; the cached output is not keyed on arguments, so
+     * requests whose arguments reach the command bypass it */
+    caching = (request->action == prog->act_status &&
+               request->action->command && prog->statuscache &&
+               (! request->action->passargs ||
+                same_args(request->argv, NULL)));
+    if (caching) {
+        res = status_lookup(request);
+        if (res != 1) return res;
+    }
     /* Do something */
     if (! request->action->command) {
         /* Perform default actions */
@@ -210,7 +389,10 @@ int request_run(struct request *request) {
             return -1;
         } else if (request->action == prog->act_restart) {
             /* Clone request */
-            struct request *req = calloc(1, sizeof(struct request));
+            req = calloc(1, sizeof(struct request));
+            if (! req) return -1;
+            req->fds[0] = req->fds[1] = req->fds[2] = -1;
+            req->creds.uid = -1;
             if (! dupfd(request->fds[0], &req->fds[0])) goto error;
             if (! dupfd(request->fds[1], &req->fds[1])) goto error;
             if (! dupfd(request->fds[2], &req->fds[2])) goto error;
@@ -218,9 +400,15 @@ int request_run(struct request *request) {
             req->program = prog;
             req->program->refcount++;
             req->action = prog->act_start;
+            if (track_inflight(config, request->creds.uid, 1) == -1)
+                goto error;
             req->argv = request->argv;
             req->creds = request->creds;
             req->addr = request->addr;
+            req->cflags = request->cflags;
+            req->flags = REQUEST_RESTART;
+            req->followers = request->followers;
+            request->followers = NULL;
             /* Call another action using this request */
             request->action = prog->act_stop;
             request->argv = NULL;
@@ -247,106 +435,100 @@ int request_run(struct request *request) {
              * -1, but accidentally killing every process we can is *not* the
              * scenario we desire. */
             if (prog->pid != -1) {
-                kill(prog->pid, SIGTERM);
+                signal_program(prog, SIGTERM);
+                if (prog->stoptimeout && arm_killer(config, prog) == -1)
+                    return -1;
             }
             /* Fall through to scheduling a waiter below */
         } else if (request->action == prog->act_status) {
-            /* Write "running" or "not running" depending on whether there is
-             * a process or not. */
-            ret = fork();
-            if (ret == 0) {
-                setup_fds(request);
-                if (prog->pid != -1) {
-                    printf("running\n");
-                    fflush(stdout);
-                    _exit(0);
-                } else {
-                    printf("not running\n");
-                    fflush(stdout);
-                    _exit(1);
-                }
-            }
+            /* Answer directly instead of spawning a process to print the
+             * status */
+            if (request->flags & REQUEST_NOREPLY) return 0;
+            return (reply_status(request)) ? 0 : -1;
         } else {
             /* Should not happen at this point */
             errno = EFAULT;
             return -1;
         }
     } else {
-        char **p, **argv, *envp[6], pidbuf[64];
+        char **p, **argv, pidbuf[64];
         struct action *act = request->action;
-        /* Prepare for job spawning */
-        int l = 4;
-        for (p = request->argv; *p; p++) l++;
-        argv = calloc(l, sizeof(char *));
-        if (! argv) return -1;
-        memcpy(argv + 3, request->argv, (l - 4) * sizeof(char *));
-        argv[0] = ACTION_SHELL;
-        argv[1] = "-c";
-        argv[2] = act->command;
-        /* Prepare environment */
-        envp[0] = concat("PATH=", ACTION_PATH);
-        envp[1] = concat("SHELL=", ACTION_SHELL);
-        envp[2] = concat("PROGNAME=", prog->name);
-        envp[3] = concat("ACTION=", act->name);
-        if (prog->pid == -1) {
-            envp[4] = "PID=";
+        struct launch lch = LAUNCH_INIT;
+        int l = act->execargc + 1;
+        struct procattr attr;
+        /* Prepare the cgroup and attributes of the program's main
+         * process */
+        if (act == prog->act_start || act == prog->act_restart) {
+            if (prog->cgroup) {
+                if (cgroup_setup(prog->cgroup, &prog->limits) == -1)
+                    return fail_cgroup(request);
+                lch.cgroup = prog->cgroup;
+            }
+            lch.attr = prog->attr;
+            if (prog->cpucount) {
+                /* Automatic placement overrides the configured CPUs */
+                if (place_programs(request->config, prog) == -1)
+                    logerr(ERROR, "Could not place programs on CPUs");
+                if (prog->flags & PROG_PLACED) {
+                    if (prog->attr) {
+                        attr = *prog->attr;
+                    } else {
+                        memset(&attr, 0, sizeof(attr));
+                    }
+                    attr.cpus = prog->placed;
+                    attr.flags |= PROCATTR_CPUS;
+                    lch.attr = &attr;
+                }
+            }
+        }
+        /* Append additional arguments, if any and applicable */
+        if (act->passargs) {
+            for (p = request->argv; *p; p++) l++;
+        }
+        if (l == act->execargc + 1) {
+            argv = act->execargv;
         } else {
+            argv = calloc(l, sizeof(char *));
+            if (! argv) return -1;
+            memcpy(argv, act->execargv, act->execargc * sizeof(char *));
+            memcpy(argv + act->execargc, request->argv,
+                   (l - act->execargc - 1) * sizeof(char *));
+        }
+        /* Fill in PID */
+        if (prog->pid != -1) {
             snprintf(pidbuf, sizeof(pidbuf), "PID=%d", prog->pid);
-            envp[4] = pidbuf;
+            act->execenvp[act->envpid] = pidbuf;
         }
-        envp[5] = NULL;
         /* Spawn child process */
-        ret = fork();
-        if (ret == 0) {
-            /* In child: open a new process group */
-            if (setpgid(0, 0) == -1) {
-                perror("setpgid");
-                _exit(126);
-            }
-            /* Configure file descriptors */
-            setup_fds(request);
-            /* Drop privileges */
-            if (act->sgid != -1 && setgid(act->sgid) == -1) {
-                perror("sgid");
-                _exit(126);
-            }
-            if (act->suid != -1 && setuid(act->suid) == -1) {
-                perror("suid");
-                _exit(126);
-            }
-            /* Change working directory */
-            if (prog->cwd && chdir(prog->cwd) == -1) {
-                perror("chdir");
-                _exit(126);
-            }
-            /* exec() script */
-            execve(argv[0], argv, envp);
-            perror("execve");
-            _exit(127);
-        } else if (ret == -1) {
-            /* Handle errors */
-            return -1;
-        }
+        lch.path = act->execpath;
+        lch.execfd = execcache_get(&request->config->execs, act->execpath);
+        lch.argv = argv;
+        lch.envp = act->execenvp;
+        memcpy(lch.fds, request->fds, sizeof(lch.fds));
+        if (caching) lch.fds[1] = prog->statusrun->fd;
+        lch.uid = act->suid;
+        lch.gid = act->sgid;
+        lch.cwd = prog->cwd;
+        lch.flags = LAUNCH_SETPGID;
+        /* The output of a status command is collected by PID, and the
+         * PID of a restarted program must change before the old process
+         * is reaped; those are spawned right away */
+        ret = request_launch(request, &lch, (! caching &&
+                                             act != prog->act_restart));
         /* Clean up */
-        for (l = 0; l < 4; l++) free(envp[l]);
+        act->execenvp[act->envpid] = "PID=";
+        if (argv != act->execargv) free(argv);
+        if (ret == -2) return fail_cgroup(request);
+        if (ret == -1) return -1;
+        /* The request continues when the spawner reports the PID */
+        if (ret == 0) return defer_launch(request);
     }
-    /* Special handling for starts and restarts */
-    if (request->action == prog->act_start ||
-            request->action == prog->act_restart) {
-        /* Update internal PID */
-        prog->pid = (ret == 0) ? -1 : ret;
-        /* Reply immediately */
-        return (request_reply(request->config->socket, &request->addr,
-                              request->cflags, 0)) ? 0 : -1;
+    /* Collect the output of a captured status command */
+    if (caching) {
+        prog->statusrun->pid = ret;
+        return (submit_reader(request, prog->statusrun)) ? ret : -1;
     }
-    /* Only falling through here if we want to wait on something ->
-     * Schedule waiter */
-    if (! (request->flags & REQUEST_NOREPLY)) {
-        int stopping = (request->action == prog->act_stop);
-        if (! submit_waiter(request, (stopping) ? prog->pid : ret))
-            return -1;
-    }
-    return ret;
+    return finish_launch(request, ret);
     /* Someting failed */
     error:
         if (req) request_free(req);
@@ -363,12 +545,313 @@ void request_free(struct request *request) {
     if (request->fds[0] != -1) close(request->fds[0]);
     if (request->fds[1] != -1) close(request->fds[1]);
     if (request->fds[2] != -1) close(request->fds[2]);
+    free_followers(request->followers);
+    track_inflight(request->config, request->creds.uid, -1);
     /* Reference-counted, might be the last reference to it */
     if (request->program && prog_del(request->program))
         free(request->program);
     free(request);
 }
 
+/* Perform queued starts as far as the concurrency limit allows */
+int run_starts(struct config *config) {
+    struct request *req;
+    struct program *cur;
+    struct job *job;
+    char msgbuf[256];
+    int res, ret = 0;
+    while (! config->holdstarts &&
+           (! config->maxstarts || config->starting < config->maxstarts)) {
+        /* Find the first start whose dependencies are not starting anymore;
+         * ones with missing dependencies fail when they are run */
+        for (job = config->starts->head; job; job = job->next) {
+            req = job->data;
+            cur = config_get(config, req->program->name);
+            if (deps_state(config, (cur) ? cur : req->program) != 0) break;
+        }
+        if (! job) break;
+        jobqueue_take(config->starts, job);
+        req->program->flags &= ~PROG_QUEUED;
+        /* The program might have been replaced by a reload meanwhile */
+        rebind_request(req);
+        req->program->flags &= ~PROG_QUEUED;
+        snprintf(msgbuf, sizeof(msgbuf), "Performing queued start of "
+                 "program '%.192s'", req->program->name);
+        logmsg(DEBUG, msgbuf);
+        res = job_run(job, JOB_NOEXIT);
+        job_free(job);
+        if (res == -1) return -1;
+        ret++;
+    }
+    return ret;
+}
+
+/* Mark the start of the given program as finished */
+int finish_start(struct config *config, struct program *prog) {
+    struct settler *st = NULL;
+    struct job *job;
+    if (prog->flags & PROG_STARTING) {
+        prog->flags &= ~PROG_STARTING;
+        config->starting--;
+    }
+    /* Drop the settler of the start, answering the request if it has been
+     * waiting for the program to become ready */
+    for (job = config->jobs->head; job; job = job->next) {
+        if (job->callback != _run_settler) continue;
+        st = job->data;
+        if (st->startgen == prog->startgen &&
+                strcmp(st->program->name, prog->name) == 0)
+            break;
+    }
+    if (job) {
+        jobqueue_take(config->jobs, job);
+        if (st->notify) {
+            if (prog->pid != -1) {
+                reply_all(config->socket, &st->replyto, st->flags,
+                          st->followers, 0);
+            } else {
+                senderr_all(config->socket, &st->replyto, st->flags,
+                            st->followers, "EXITED", "Program exited "
+                            "before becoming ready");
+            }
+        }
+        job_free(job);
+    }
+    /* Starts depending on the program might be able to proceed (or fail)
+     * now even if it has not been starting */
+    return run_starts(config);
+}
+
+/* Begin stopping all programs because the daemon is exiting */
+int begin_shutdown(struct config *config) {
+    struct program *prog;
+    double now = timestamp();
+    if (config->shutdown) {
+        /* Asked again; do not wait any longer */
+        config->deadline = now;
+        return 0;
+    }
+    logmsg(NOTE, "Shutting down...");
+    config->shutdown = now;
+    config->deadline = (config->shutdowntimeout) ?
+        now + config->shutdowntimeout : INFINITY;
+    /* Nothing is to be (re)started anymore */
+    for (prog = config->programs; prog; prog = prog->next) {
+        if (prog->flags & PROG_QUEUED) cancel_start(config, prog);
+        prog->flags &= ~PROG_RUNNING;
+    }
+    return 0;
+}
+
+/* Stop the programs that may be stopped now during shutdown */
+int shutdown_step(struct config *config) {
+    struct program *prog;
+    struct request *req;
+    char msgbuf[256];
+    double now = timestamp();
+    int ret = 0;
+    /* Enforce the deadline */
+    if (now >= config->deadline && ! config->killed) {
+        logmsg(WARN, "Shutdown timed out; killing remaining programs");
+        for (prog = config->programs; prog; prog = prog->next) {
+            if (prog->pid == -1) continue;
+            if (! (prog->flags & PROG_STOPPING)) {
+                prog->flags |= PROG_STOPPING;
+                prog->stopped = now;
+            }
+            signal_program(prog, SIGKILL);
+        }
+        config->killed = 1;
+    }
+    for (prog = config->programs; prog; prog = prog->next) {
+        /* Programs being spawned are stopped once they are running */
+        if (prog->flags & PROG_SPAWNING) ret++;
+        if (prog->pid == -1) continue;
+        ret++;
+        if (prog->flags & PROG_STOPPING || has_dependents(config, prog))
+            continue;
+        prog->flags |= PROG_STOPPING;
+        prog->stopped = now;
+        req = request_synth(config, prog, "stop", NULL);
+        if (! req) return -1;
+        snprintf(msgbuf, sizeof(msgbuf), "Stopping program '%.192s'",
+                 prog->name);
+        logmsg(INFO, msgbuf);
+        if (request_run(req) == -1 && errno) {
+            request_free(req);
+            return -1;
+        }
+        request_free(req);
+    }
+    /* Processes that survive SIGKILL are not worth waiting for */
+    if (ret && config->killed && now >= config->deadline + SHUTDOWN_GRACE) {
+        logmsg(WARN, "Programs left running after shutdown");
+        return 0;
+    }
+    return ret;
+}
+
+/* Send the given signal to the processes of the given program */
+int signal_program(struct program *prog, int sig) {
+    if (prog->pid == -1) {
+        errno = ESRCH;
+        return -1;
+    }
+    if (prog->killmode == KILL_CGROUP && prog->cgroup) {
+        /* The main process is in the cgroup as well, unless it could not
+         * be put there */
+        if (cgroup_signal(prog->cgroup, sig) > 0) return 0;
+    } else if (prog->killmode != KILL_PROCESS) {
+        /* The main process leads its own process group */
+        if (kill(-prog->pid, sig) == 0 || errno != ESRCH) return 0;
+    }
+    return kill(prog->pid, sig);
+}
+
+/* Determine the delay before restarting the given program automatically */
+double restart_backoff(struct program *prog) {
+    double now = timestamp(), ret;
+    /* Count restarts */
+    if (prog->limit > 0) {
+        if (now - prog->winstart >= prog->window) {
+            prog->winstart = now;
+            prog->restarts = 0;
+        }
+        if (++prog->restarts > prog->limit) {
+            prog->flags |= PROG_QUARANTINED;
+            prog->flags &= ~PROG_RUNNING;
+            return -1;
+        }
+    }
+    /* Back off, unless the program has run stably */
+    if (prog->curdelay <= 0 || prog->delaymax <= prog->delay ||
+            now - prog->started >= prog->stable) {
+        prog->curdelay = (prog->delay > 0) ? prog->delay : 0;
+    } else {
+        prog->curdelay *= prog->multiplier;
+        if (prog->curdelay > prog->delaymax) prog->curdelay = prog->delaymax;
+    }
+    ret = prog->curdelay;
+    if (prog->jitter > 0) ret *= 1 + prog->jitter * (2 * drand48() - 1);
+    prog->restartcount++;
+    return ret;
+}
+
+/* Re-evaluate the automatic CPU placement of all programs */
+int place_programs(struct config *config, struct program *starting) {
+    struct program *prog;
+    cpu_set_t set;
+    char msgbuf[512], cpubuf[256];
+    int *load;
+    /* Read the topology when it is needed first */
+    if (! config->cpumap) {
+        for (prog = config->programs; prog; prog = prog->next) {
+            if (prog->cpucount) break;
+        }
+        if (! prog) return 0;
+        config->cpumap = cpumap_read();
+        if (! config->cpumap) return -1;
+    }
+    load = calloc(config->cpumap->count, sizeof(int));
+    if (! load) return -1;
+    /* Place programs in list order */
+    for (prog = config->programs; prog; prog = prog->next) {
+        if (! prog->cpucount || (prog->pid == -1 && prog != starting)) {
+            prog->flags &= ~PROG_PLACED;
+            continue;
+        }
+        cpumap_place(config->cpumap, load, prog->cpucount, &set);
+        if (prog->flags & PROG_PLACED && CPU_EQUAL(&set, &prog->placed))
+            continue;
+        prog->placed = set;
+        prog->flags |= PROG_PLACED;
+        snprintf(msgbuf, sizeof(msgbuf), "Placing program '%.192s' on "
+            "CPUs %s", prog->name, cpuset_format(&set, cpubuf,
+                                                 sizeof(cpubuf)));
+        logmsg(INFO, msgbuf);
+        if (prog != starting && prog->pid != -1 &&
+                cpuset_apply(prog->pid, &set) == -1)
+            logerr(WARN, "Could not move program to its CPUs");
+    }
+    free(load);
+    return 0;
+}
+
+/* Process pending readiness notifications */
+int handle_notify(struct config *config) {
+    char buf[4096], msgbuf[256], *line, *save;
+    struct program *prog;
+    int pid, res;
+    for (;;) {
+        res = comm_recv_notify(config->notify, buf, sizeof(buf), &pid);
+        if (res == -2) return 0;
+        if (res == -1) return -1;
+        prog = notify_sender(config, pid);
+        if (! prog && config->spawns->head) {
+            /* The spawner might not have reported the sender yet */
+            if (handle_spawns(config, 1) == -1) return -1;
+            prog = notify_sender(config, pid);
+        }
+        if (! prog || (! prog->notify && ! prog->watchdog)) continue;
+        for (line = strtok_r(buf, "\n", &save); line;
+                line = strtok_r(NULL, "\n", &save)) {
+            if (strcmp(line, "WATCHDOG=1") == 0 && prog->watchdog) {
+                prog->wdeadline = timestamp() + prog->watchdog;
+                continue;
+            }
+            if (strcmp(line, "READY=1") != 0 || ! prog->notify ||
+                    ! (prog->flags & PROG_STARTING))
+                continue;
+            snprintf(msgbuf, sizeof(msgbuf), "Program '%.192s' is ready",
+                     prog->name);
+            logmsg(INFO, msgbuf);
+            if (finish_start(config, prog) == -1) return -1;
+        }
+    }
+}
+
+/* Continue the requests whose processes the spawner has reported */
+int handle_spawns(struct config *config, int wait) {
+    struct program *prog;
+    struct request *req;
+    struct job *job;
+    int pid, res, pending = 0, ret = 0;
+    if (wait) {
+        for (job = config->spawns->head; job; job = job->next) pending++;
+    }
+    while (config->spawner != -1) {
+        res = launch_result(config->spawner, &pid,
+                            (ret < pending) ? 0 : COMM_DONTWAIT);
+        if (res == 0) break;
+        if (res == 1 && ! config->spawns->head) {
+            errno = EBADMSG;
+            res = -1;
+        }
+        if (res == -1) {
+            logerr(ERROR, "Spawn helper failed; not using it anymore");
+            if (drop_spawner(config) == -1) return -1;
+            break;
+        }
+        job = jobqueue_take(config->spawns, config->spawns->head);
+        req = job->data;
+        res = finish_spawn(req, pid);
+        if (res == -1 && errno) {
+            job_free(job);
+            return -1;
+        }
+        /* Garbage-collect removed programs that did not start after all */
+        prog = req->program;
+        if (prog->flags & PROG_REMOVE && prog->pid == -1 &&
+                ! (prog->flags & (PROG_RUNNING | PROG_SPAWNING)) &&
+                config_get(config, prog->name) == prog)
+            config_remove(config, prog);
+        job_free(job);
+        ret++;
+    }
+    if (ret && run_starts(config) == -1) return -1;
+    return ret;
+}
+
 /* Extract jobs matching the given PID from the queue and run them */
 int run_jobs(struct config *config, int pid, int retcode) {
     struct job *list, *next;
@@ -416,7 +899,7 @@ int send_request(struct config *config, char **argv, int flags) {
         if (strcmp(argv[1], "reload") != 0 &&
             strcmp(argv[1], "shutdown") != 0) return 0;
     } else if (strcmp(argv[0], "LIST") == 0) {
-        if (msg.fieldnum != 1) return 0;
+        if (msg.fieldnum > 3) return 0;
     } else if (strcmp(argv[0], "PING") == 0) {
         if (msg.fieldnum > 2) return 0;
     } else {
@@ -483,8 +966,9 @@ int get_reply(struct config *config, struct strarr *data, int flags) {
             goto error;
         }
     } else if (strcmp(msg.fields[0], "LISTING") == 0) {
-        /* Verify adequate length */
-        ret = (msg.fieldnum % 2 == 1) ? 0 : 1;
+        /* Verify adequate length (there is a continuation marker, the
+         * generation, and the kind of listing) */
+        ret = (msg.fieldnum >= 4 && msg.fieldnum % 2 == 0) ? 0 : 1;
     } else if (strcmp(msg.fields[0], "PONG") == 0) {
         ret = 0;
     } else {
@@ -508,55 +992,666 @@ int get_reply(struct config *config, struct strarr *data, int flags) {
         return ret;
 }
 
-int close_from(int minfd) {
-    int i, dfd, fd, ret = -1;
-    DIR *dir;
-    char path[PATH_MAX], *end;
-    /* Close all below 1024 */
-    for (i = minfd; i < 1024; i++) close(i);
-    /* Detect remaining FD-s from /proc */
-    snprintf(path, sizeof(path), "/proc/%d/fd/", getpid());
-    dir = opendir(path);
-    if (! dir) return -1;
-    dfd = dirfd(dir);
-    for (;;) {
-        struct dirent *ent;
-        errno = 0;
-        ent = readdir(dir);
-        if (! ent && errno) goto end;
-        errno = 0;
-        fd = strtol(ent->d_name, &end, 10);
-        if (*end || errno) {
-            errno = EINVAL;
+/* Retrieve the listing of all (or all changed) programs page by page */
+int get_listing(struct config *config, struct strarr *data, char *since,
+                int flags) {
+    char *argv[4] = { "LIST", NULL, NULL, NULL }, *after = NULL, **grown;
+    struct strarr page = { 0, NULL }, ret = { 0, NULL };
+    int res, more, i;
+    if (since) {
+        argv[1] = concat("since=", since);
+        if (! argv[1]) return REPLY_ERROR;
+    }
+    do {
+        /* Request the next page */
+        argv[(since) ? 2 : 1] = after;
+        res = send_request(config, argv, flags);
+        if (res <= 0) {
+            if (res == 0) errno = EINVAL;
+            res = REPLY_ERROR;
             goto end;
         }
-        if (fd < minfd || fd == dfd) continue;
-        close(fd);
-    }
-    ret = 0;
+        res = get_reply(config, &page, flags);
+        if (res != 0) goto end;
+        if (strcmp(page.data[0], "LISTING") != 0 ||
+                (strcmp(page.data[1], "more") != 0 &&
+                 strcmp(page.data[1], "end") != 0) ||
+                strncmp(page.data[2], "gen=", 4) != 0) {
+            res = 1;
+            goto end;
+        }
+        /* A full listing could have been sent instead of a delta midway
+         * (if too many programs have been removed meanwhile) */
+        if (ret.len && strcmp(page.data[3], ret.data[2]) != 0) {
+            fprintf(stderr, "ERROR: (ESTALE) Listing changed meanwhile\n");
+            res = REPLY_ERROR;
+            errno = 0;
+            goto end;
+        }
+        /* An empty page that is not the last one would never end */
+        more = (strcmp(page.data[1], "more") == 0);
+        if (more && page.len == 4) {
+            res = 1;
+            goto end;
+        }
+        free(after);
+        after = NULL;
+        if (more) {
+            after = concat("after=", page.data[page.len - 2]);
+            if (! after) {
+                res = REPLY_ERROR;
+                goto end;
+            }
+        }
+        /* Append the entries to the result, keeping the header of the
+         * first page only */
+        grown = realloc(ret.data, (((ret.len) ? ret.len : 3) + page.len -
+                                   4) * sizeof(char *));
+        if (! grown) {
+            res = REPLY_ERROR;
+            goto end;
+        }
+        ret.data = grown;
+        if (! ret.len) {
+            ret.data[ret.len++] = page.data[0];
+            ret.data[ret.len++] = page.data[2];
+            ret.data[ret.len++] = page.data[3];
+            page.data[0] = page.data[2] = page.data[3] = NULL;
+        }
+        for (i = 4; i < page.len; i++) {
+            ret.data[ret.len++] = page.data[i];
+            page.data[i] = NULL;
+        }
+        for (i = 0; i < page.len; i++) free(page.data[i]);
+        free(page.data);
+        page.data = NULL;
+        page.len = 0;
+    } while (more);
+    /* Hand out the result */
+    *data = ret;
+    ret.data = NULL;
+    ret.len = 0;
+    res = 0;
     end:
-        closedir(dir);
-        return ret;
+        if (since) free(argv[1]);
+        free(after);
+        for (i = 0; i < page.len; i++) free(page.data[i]);
+        free(page.data);
+        for (i = 0; i < ret.len; i++) free(ret.data[i]);
+        free(ret.data);
+        return res;
+}
+
+/* Add the tokens accumulated since the last update to the given bucket
+ * burst is the capacity of the bucket; if it is not positive, the rate
+ * (but at least 1) is used. Returns whether the bucket is full. */
+int fill_bucket(struct bucket *bucket, double rate, double burst,
+                double now) {
+    if (burst <= 0) burst = (rate > 1) ? rate : 1;
+    bucket->tokens += (now - bucket->stamp) * rate;
+    bucket->stamp = now;
+    if (bucket->tokens < burst) return 0;
+    bucket->tokens = burst;
+    return 1;
+}
+
+/* Return the amount of actions in progress on behalf of clients with the
+ * given UID
+ * These are requests queued for later (including those waiting for the
+ * spawner), as well as spawned actions whose clients are waiting for a
+ * reply; see track_inflight(). */
+int count_inflight(struct config *config, int uid) {
+    struct uidcount *cur;
+    for (cur = config->uidinflight; cur; cur = cur->next) {
+        if (cur->uid == uid) return cur->count;
+    }
+    return 0;
+}
+
+/* Account for an action starting (if delta is 1) or ceasing (if delta is -1)
+ * to be in progress on behalf of a client with the given UID
+ * Nothing happens if uid is -1. Every object holding an action in progress
+ * (a request, or the data of a job replying to a client) does this when it
+ * takes on and when it gives up the UID it stores.
+ * Returns zero on success, or -1 on error (with nothing changed). */
+int track_inflight(struct config *config, int uid, int delta) {
+    struct uidcount *cur, **pcur;
+    if (uid == -1) return 0;
+    for (pcur = &config->uidinflight; *pcur; pcur = &(*pcur)->next) {
+        if ((*pcur)->uid == uid) break;
+    }
+    cur = *pcur;
+    if (! cur) {
+        cur = malloc(sizeof(struct uidcount));
+        if (! cur) return -1;
+        cur->uid = uid;
+        cur->count = 0;
+        cur->next = NULL;
+        *pcur = cur;
+    }
+    cur->count += delta;
+    config->inflight += delta;
+    if (cur->count <= 0) {
+        *pcur = cur->next;
+        free(cur);
+    }
+    return 0;
+}
+
+/* Spawn a process on behalf of the given request, submitting it to the
+ * spawner if possible and remote is true
+ * Returns the PID of the process, 0 if it has been submitted to the spawner
+ * (and the request is to be continued by handle_spawns()), -2 if it could
+ * not be placed into its cgroup, or -1 on other errors. */
+int request_launch(struct request *request, struct launch *l, int remote) {
+    struct config *config = request->config;
+    if (remote && config->spawner != -1) {
+        if (launch_remote(config->spawner, l) == 0) return 0;
+        if (errno != E2BIG && errno != EAGAIN) {
+            /* Spawner is defunct (or confused); continue without it */
+            logerr(ERROR, "Spawn helper failed; not using it anymore");
+            if (drop_spawner(config) == -1) return -1;
+        }
+    }
+    return launch(l);
+}
+
+/* Conclude the given request after its process (if any) has been spawned
+ * with the given PID (or 0 if none has been spawned)
+ * Returns like request_run(). */
+int finish_launch(struct request *request, int ret) {
+    struct program *prog = request->program;
+    int res, starting = ((request->action == prog->act_start ||
+                          request->action == prog->act_restart) &&
+                         request->action->command);
+    /* Special handling for starts and restarts */
+    if (request->action == prog->act_start ||
+            request->action == prog->act_restart) {
+        /* Update internal PID */
+        prog->pid = (ret == 0) ? -1 : ret;
+        if (starting && prog->pid != -1) {
+            res = begin_start(request);
+            if (res == -1) return -1;
+            /* The reply is sent when the program is ready */
+            if (res == 1) return 0;
+        }
+        /* Reply immediately */
+        return (reply_all(request->config->socket, &request->addr,
+                          request->cflags, request->followers, 0)) ? 0 : -1;
+    }
+    /* Only falling through here if we want to wait on something ->
+     * Schedule waiter */
+    if (! (request->flags & REQUEST_NOREPLY)) {
+        int stopping = (request->action == prog->act_stop);
+        if (! submit_waiter(request, (stopping) ? prog->pid : ret))
+            return -1;
+    }
+    return ret;
+}
+
+/* Keep the given request until the spawner reports the PID of its process
+ * The contents of the request are moved into a new one (as with
+ * defer_start()), which is appended to the spawns queue; starts count as
+ * starting from now on. Returns zero on success, or -1 on error. */
+int defer_launch(struct request *request) {
+    struct config *config = request->config;
+    struct program *prog = request->program;
+    struct request *req = malloc(sizeof(struct request));
+    struct job *job;
+    if (! req) return -1;
+    /* The job is never run; the callback marks it as holding a request
+     * (see find_leader()) */
+    job = job_new(_run_request, _free_request, req);
+    if (! job) {
+        free(req);
+        return -1;
+    }
+    *req = *request;
+    req->program->refcount++;
+    request->argv = NULL;
+    request->followers = NULL;
+    request->fds[0] = request->fds[1] = request->fds[2] = -1;
+    request->creds.uid = -1;
+    jobqueue_append(config->spawns, job);
+    if (req->action == prog->act_start) {
+        prog->flags |= PROG_SPAWNING;
+        config->starting++;
+    }
+    return 0;
+}
+
+/* Continue the given request, whose process the spawner has reported to
+ * have the given PID (or to have failed like launch(), with errno set)
+ * Returns like request_run(). */
+int finish_spawn(struct request *request, int pid) {
+    struct program *prog;
+    rebind_request(request);
+    prog = request->program;
+    if (request->action == prog->act_start) {
+        prog->flags &= ~PROG_SPAWNING;
+        request->config->starting--;
+    }
+    if (pid == -2) return fail_cgroup(request);
+    if (pid == -1) return -1;
+    return finish_launch(request, pid);
+}
+
+/* Fail the given start because its program could not be placed into its
+ * cgroup; this is a matter of configuration rather than a fatal error
+ * Returns like request_run(). */
+int fail_cgroup(struct request *request) {
+    logerr(ERROR, "Could not start program in its cgroup");
+    request->program->flags &= ~PROG_RUNNING;
+    return (request_senderr(request, "CGROUP",
+                            "Could not set up cgroup")) ? 0 : -1;
+}
+
+/* Stop using the spawner, failing the launches still pending with it
+ * Returns zero on success, or -1 on fatal error. */
+int drop_spawner(struct config *config) {
+    struct request *req;
+    struct job *job;
+    int ret = 0;
+    close(config->spawner);
+    config->spawner = -1;
+    while (config->spawns->head) {
+        job = jobqueue_take(config->spawns, config->spawns->head);
+        req = job->data;
+        rebind_request(req);
+        if (req->action == req->program->act_start) {
+            req->program->flags &= ~(PROG_SPAWNING | PROG_RUNNING);
+            config->starting--;
+        }
+        if (! request_senderr(req, "SPAWNER", "Spawn helper failed"))
+            ret = -1;
+        job_free(job);
+    }
+    return ret;
 }
 
-/* Set up file descriptors for running as a child */
-int setup_fds(struct request *request) {
-    /* Override stdio with those in the request */
-    if (request->fds[0] != -1 && dup2(request->fds[0], 0) == -1) return -1;
-    if (request->fds[1] != -1 && dup2(request->fds[1], 1) == -1) return -1;
-    if (request->fds[2] != -1 && dup2(request->fds[2], 2) == -1) return -1;
-    if (request->fds[0] == -1) close(0);
-    if (request->fds[1] == -1) close(1);
-    if (request->fds[2] == -1) close(2);
-    return close_from(3);
+/* Make the given request refer to the program of the same name currently
+ * configured, in case a reload has replaced its program */
+void rebind_request(struct request *request) {
+    struct program *cur = config_get(request->config,
+                                     request->program->name);
+    if (! cur || cur == request->program) return;
+    cur->refcount++;
+    request->action = prog_action(cur, request->action->name);
+    if (prog_del(request->program)) free(request->program);
+    request->program = cur;
+}
+
+/* Attach the given request to an identical one in progress, if any
+ * Returns 0 if the request has been attached (or dropped as it needs no
+ * reply), 1 if there is nothing to attach to, or -1 on error. */
+int follow_request(struct request *request) {
+    struct program *prog = request->program;
+    struct request *leader;
+    struct follower *fl;
+    struct job *job;
+    char msgbuf[256];
+    if (request->flags & REQUEST_RESTART) return 1;
+    if ((request->action == prog->act_start ||
+         request->action == prog->act_restart) &&
+            (request->action == prog->act_start ||
+             ! request->action->command)) {
+        leader = find_leader(request);
+        if (! leader) return 1;
+        if (request->addr.addrlen) {
+            fl = malloc(sizeof(struct follower));
+            if (! fl) return -1;
+            fl->addr = request->addr;
+            fl->cflags = request->cflags;
+            fl->next = leader->followers;
+            leader->followers = fl;
+        }
+    } else if (request->action == prog->act_stop &&
+               ! request->action->command) {
+        job = find_waiter(request);
+        if (! job) return 1;
+        if (! (request->flags & REQUEST_NOREPLY) &&
+                ! submit_waiter(request, job->waitfor))
+            return -1;
+    } else {
+        return 1;
+    }
+    snprintf(msgbuf, sizeof(msgbuf), "Attaching %s of program '%.192s' to "
+             "an identical one in progress", request->action->name,
+             prog->name);
+    logmsg(DEBUG, msgbuf);
+    return 0;
+}
+
+/* Find a pending start identical to the given start or default restart
+ * request
+ * Restarts match the start halves of restarts waiting for the program to
+ * exit (or queued, or being spawned), and starts match queued starts and
+ * starts being spawned. */
+struct request *find_leader(struct request *request) {
+    struct jobqueue *queues[3] = { request->config->jobs,
+                                   request->config->starts,
+                                   request->config->spawns };
+    int restart = (request->action == request->program->act_restart);
+    struct request *req;
+    struct job *job;
+    int i;
+    for (i = 0; i < 3; i++) {
+        for (job = queues[i]->head; job; job = job->next) {
+            if (job->callback != _run_request) continue;
+            req = job->data;
+            if (strcmp(req->program->name, request->program->name) != 0 ||
+                    req->action != req->program->act_start ||
+                    ! (req->flags & REQUEST_RESTART) != ! restart ||
+                    ! same_args(req->argv, request->argv))
+                continue;
+            /* Plain starts only match queued (or spawning) ones (and not,
+             * e.g., delayed automatic restarts) */
+            if (restart || queues[i] != request->config->jobs)
+                return req;
+        }
+    }
+    return NULL;
+}
+
+/* Find the waiter of a default stop identical to the given (default stop)
+ * request that is in progress
+ * Only stops without arguments are considered. */
+struct job *find_waiter(struct request *request) {
+    struct waiter *wt;
+    struct job *job;
+    if (! same_args(request->argv, NULL)) return NULL;
+    for (job = request->config->jobs->head; job; job = job->next) {
+        if (job->callback != _run_waiter) continue;
+        wt = job->data;
+        if (wt->stop && wt->plain && wt->program == request->program)
+            return job;
+    }
+    return NULL;
+}
+
+/* Check whether the argument lists (either of which may be NULL) are
+ * equal */
+int same_args(char **a, char **b) {
+    char *empty[] = { NULL };
+    if (! a) a = empty;
+    if (! b) b = empty;
+    for (; *a && *b; a++, b++) {
+        if (strcmp(*a, *b) != 0) return 0;
+    }
+    return (! *a && ! *b);
+}
+
+/* Deallocate the given list of followers */
+void free_followers(struct follower *list) {
+    struct follower *next;
+    for (; list; list = next) {
+        next = list->next;
+        free(list);
+    }
+}
+
+/* Start the programs required by the one of the given request that are
+ * neither running nor about to be
+ * The program is marked while doing so to cut short dependency cycles.
+ * Returns zero on success, or -1 on fatal error. */
+int pull_deps(struct request *request) {
+    struct program *prog = request->program, *dep;
+    struct request *req;
+    char msgbuf[512], **p;
+    int res;
+    if (! prog->requires) return 0;
+    prog->flags |= PROG_VISITING;
+    for (p = prog->requires; *p; p++) {
+        dep = config_get(request->config, *p);
+        if (! dep || dep->pid != -1 ||
+                dep->flags & (PROG_QUEUED | PROG_STARTING | PROG_SPAWNING |
+                              PROG_VISITING))
+            continue;
+        snprintf(msgbuf, sizeof(msgbuf), "Starting program '%.192s' "
+                 "required by '%.192s'", dep->name, prog->name);
+        logmsg(INFO, msgbuf);
+        req = request_synth(request->config, dep, "start", NULL);
+        if (! req) goto error;
+        res = request_run(req);
+        request_free(req);
+        if (res == -1 && errno) goto error;
+    }
+    prog->flags &= ~PROG_VISITING;
+    return 0;
+    error:
+        prog->flags &= ~PROG_VISITING;
+        return -1;
+}
+
+/* Check whether the dependencies of the given program permit starting it
+ * Returns 1 if they do, 0 if some of them are still starting (or waiting to
+ * start), or -1 if a required program is missing and not about to start. */
+int deps_state(struct config *config, struct program *prog) {
+    struct program *dep;
+    char **p;
+    int ret = 1;
+    if (prog->requires) {
+        for (p = prog->requires; *p; p++) {
+            dep = config_get(config, *p);
+            if (! dep) return -1;
+            if (dep->flags & (PROG_QUEUED | PROG_STARTING | PROG_SPAWNING)) {
+                ret = 0;
+            } else if (dep->pid == -1) {
+                return -1;
+            }
+        }
+    }
+    if (prog->after) {
+        for (p = prog->after; *p; p++) {
+            dep = config_get(config, *p);
+            if (dep && dep->flags & (PROG_QUEUED | PROG_STARTING |
+                                     PROG_SPAWNING))
+                ret = 0;
+        }
+    }
+    return ret;
+}
+
+/* Queue the given start request to be performed when the concurrency limit
+ * permits
+ * The contents of the request are moved into a new one, which is kept in the
+ * queue; the request passed can be freed as usual. Returns zero on success,
+ * or -1 on error. */
+int defer_start(struct request *request) {
+    struct program *prog = request->program;
+    struct job *job, *cur;
+    struct request *req = malloc(sizeof(struct request));
+    char msgbuf[256];
+    if (! req) return -1;
+    job = job_new(_run_request, _free_request, req);
+    if (! job) {
+        free(req);
+        return -1;
+    }
+    *req = *request;
+    req->program->refcount++;
+    request->argv = NULL;
+    request->followers = NULL;
+    request->fds[0] = request->fds[1] = request->fds[2] = -1;
+    request->creds.uid = -1;
+    /* Insert after all starts of at least the same priority */
+    for (cur = request->config->starts->head; cur; cur = cur->next) {
+        if (((struct request *) cur->data)->program->priority <
+                prog->priority)
+            break;
+    }
+    jobqueue_insert(request->config->starts, cur, job);
+    prog->flags |= PROG_QUEUED;
+    snprintf(msgbuf, sizeof(msgbuf), "Queueing start of program '%.192s'",
+             prog->name);
+    logmsg(DEBUG, msgbuf);
+    return 0;
+}
+
+/* Drop the queued start of the given program, notifying its requestor */
+void cancel_start(struct config *config, struct program *prog) {
+    struct job *cur;
+    struct request *req;
+    for (cur = config->starts->head; cur; cur = cur->next) {
+        req = cur->data;
+        if (req->program == prog || strcmp(req->program->name,
+                                           prog->name) == 0)
+            break;
+    }
+    prog->flags &= ~PROG_QUEUED;
+    if (! cur) return;
+    jobqueue_take(config->starts, cur);
+    request_senderr(req, "CANCELLED", "Program start cancelled");
+    job_free(cur);
+}
+
+/* Mark the program of the given start request as starting until it has
+ * settled or is ready
+ * Returns 1 if the reply to the request is deferred until the program is
+ * ready, 0 if not, or -1 on error. */
+int begin_start(struct request *request) {
+    struct config *config = request->config;
+    struct program *prog = request->program;
+    struct settler *st;
+    struct job *job;
+    prog->startgen++;
+    prog->started = timestamp();
+    prog->flags &= ~PROG_TIMEDOUT;
+    if (health_schedule(config, prog) == -1) return -1;
+    if (prog->watchdog) {
+        prog->wdeadline = prog->started + prog->watchdog;
+        if (arm_watchdog(config, prog, prog->startgen) == -1) return -1;
+    }
+    if (! prog->notify && ! config->settle)
+        return (finish_start(config, prog) == -1) ? -1 : 0;
+    st = malloc(sizeof(struct settler));
+    if (! st) return -1;
+    job = job_new(_run_settler, _free_settler, st);
+    if (! job) {
+        free(st);
+        return -1;
+    }
+    st->config = config;
+    st->program = prog;
+    st->startgen = prog->startgen;
+    st->notify = prog->notify;
+    st->uid = -1;
+    st->replyto.addrlen = 0;
+    st->flags = 0;
+    st->followers = NULL;
+    prog->refcount++;
+    if (prog->notify) {
+        /* Wait for the program to report readiness */
+        if (request->addr.addrlen) {
+            if (track_inflight(config, request->creds.uid, 1) == -1) {
+                job_free(job);
+                return -1;
+            }
+            st->uid = request->creds.uid;
+        }
+        st->replyto = request->addr;
+        st->flags = request->cflags;
+        st->followers = request->followers;
+        request->followers = NULL;
+        job->notBefore = (prog->timeout) ? timestamp() + prog->timeout :
+            INFINITY;
+    } else {
+        job->notBefore = timestamp() + config->settle;
+    }
+    jobqueue_append(config->jobs, job);
+    if (! (prog->flags & PROG_STARTING)) {
+        prog->flags |= PROG_STARTING;
+        config->starting++;
+    }
+    return prog->notify;
+}
+
+/* Schedule the given program to be killed if it does not stop in time
+ * Returns zero on success, or -1 on error. */
+int arm_killer(struct config *config, struct program *prog) {
+    struct settler *st;
+    struct job *job;
+    st = malloc(sizeof(struct settler));
+    if (! st) return -1;
+    job = job_new(_run_killer, _free_settler, st);
+    if (! job) {
+        free(st);
+        return -1;
+    }
+    memset(st, 0, sizeof(*st));
+    st->config = config;
+    st->uid = -1;
+    st->program = prog;
+    st->startgen = prog->startgen;
+    prog->refcount++;
+    job->notBefore = timestamp() + prog->stoptimeout;
+    jobqueue_append(config->jobs, job);
+    return 0;
+}
+
+/* Schedule a check whether the given program has sent a keepalive message
+ * by its current deadline
+ * Returns zero on success, or -1 on error. */
+int arm_watchdog(struct config *config, struct program *prog, int startgen) {
+    struct settler *st;
+    struct job *job;
+    st = malloc(sizeof(struct settler));
+    if (! st) return -1;
+    job = job_new(_run_watchdog, _free_settler, st);
+    if (! job) {
+        free(st);
+        return -1;
+    }
+    memset(st, 0, sizeof(*st));
+    st->config = config;
+    st->uid = -1;
+    st->program = prog;
+    st->startgen = startgen;
+    prog->refcount++;
+    job->notBefore = prog->wdeadline;
+    jobqueue_append(config->jobs, job);
+    return 0;
+}
+
+/* Check whether any running program depends on the given one */
+int has_dependents(struct config *config, struct program *prog) {
+    struct program *cur;
+    char **p;
+    for (cur = config->programs; cur; cur = cur->next) {
+        if (cur == prog || cur->pid == -1) continue;
+        if (cur->requires) {
+            for (p = cur->requires; *p; p++) {
+                if (strcmp(*p, prog->name) == 0) return 1;
+            }
+        }
+        if (cur->after) {
+            for (p = cur->after; *p; p++) {
+                if (strcmp(*p, prog->name) == 0) return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+/* Return the program the process pid belongs to, if any
+ * That is a program whose main process is pid or leads the process group
+ * of pid. */
+struct program *notify_sender(struct config *config, int pid) {
+    struct program *ret;
+    int pgid;
+    if (pid <= 0) return NULL;
+    ret = config_getpid(config, pid);
+    if (ret) return ret;
+    pgid = getpgid(pid);
+    if (pgid <= 0) return NULL;
+    return config_getpid(config, pgid);
 }
 
 /* Send an error message to the client as specified by the given request,
  * and return whether that succeeded. */
 int request_senderr(struct request *request, char *code, char *desc) {
-    if (! request->addr.addrlen) return 1;
-    return (comm_senderr(request->config->socket, code, desc,
-                         &request->addr, request->cflags) != -1);
+    return senderr_all(request->config->socket, &request->addr,
+                       request->cflags, request->followers, code, desc);
 }
 
 /* Send a successful completion message */
@@ -570,21 +1665,160 @@ int request_reply(int fd, struct addr *addr, int flags, int code) {
     return (comm_send(fd, &msg, addr, flags) != -1);
 }
 
+/* Reply to a status request of a program without a status command */
+int reply_status(struct request *request) {
+    struct program *prog = request->program;
+    char codebuf[16], pidbuf[32], upbuf[64], exitbuf[32], *fields[6];
+    struct ctlmsg msg = CTLMSG_INIT;
+    if (! request->addr.addrlen) return 1;
+    msg.fields = fields;
+    fields[msg.fieldnum++] = "OK";
+    snprintf(codebuf, sizeof(codebuf), "%d", (prog->pid != -1) ? 0 : 1);
+    fields[msg.fieldnum++] = codebuf;
+    if (prog->pid == -1) {
+        fields[msg.fieldnum++] = "state=stopped";
+    } else {
+        fields[msg.fieldnum++] = (prog->flags & PROG_STARTING) ?
+            "state=starting" : "state=running";
+        snprintf(pidbuf, sizeof(pidbuf), "pid=%d", prog->pid);
+        fields[msg.fieldnum++] = pidbuf;
+        snprintf(upbuf, sizeof(upbuf), "uptime=%.3f",
+                 timestamp() - prog->started);
+        fields[msg.fieldnum++] = upbuf;
+    }
+    if (prog->exited) {
+        snprintf(exitbuf, sizeof(exitbuf), "exit=%d", prog->exitcode);
+        fields[msg.fieldnum++] = exitbuf;
+    }
+    return (comm_send(request->config->socket, &msg, &request->addr,
+                      request->cflags) != -1);
+}
+
+/* Answer a status request from the status command execution of its
+ * program if it is running or recent enough
+ * Returns 0 if the request has been taken care of, 1 if the command is to
+ * be run anew (prog->statusrun has been replaced for that), or -1 on
+ * error. */
+int status_lookup(struct request *request) {
+    struct program *prog = request->program;
+    struct statusrun *run = prog->statusrun;
+    if (run && run->pid != -1)
+        return (submit_reader(request, run)) ? 0 : -1;
+    if (run && run->finished &&
+            timestamp() - run->finished < prog->statuscache / 1000.0) {
+        if (request->flags & REQUEST_NOREPLY) return 0;
+        return (reply_output(request->config->socket, &request->addr,
+                             request->cflags, run)) ? 0 : -1;
+    }
+    if (run && statusrun_del(run)) free(run);
+    prog->statusrun = statusrun_new();
+    return (prog->statusrun) ? 1 : -1;
+}
+
+/* Relay the result of a status command execution */
+int reply_output(int fd, struct addr *addr, int flags,
+                 struct statusrun *run) {
+    char numbuf[64], *fields[] = { "OK", numbuf, NULL };
+    struct ctlmsg msg = CTLMSG_INIT;
+    int ret;
+    if (! addr->addrlen) return 1;
+    snprintf(numbuf, sizeof(numbuf), "%d", run->code);
+    fields[2] = concat("output=", (run->output) ? run->output : "");
+    if (! fields[2]) return 0;
+    msg.fields = fields;
+    msg.fieldnum = sizeof(fields) / sizeof(*fields);
+    ret = (comm_send(fd, &msg, addr, flags) != -1);
+    free(fields[2]);
+    return ret;
+}
+
+/* Schedule a job relaying the result of the given status command
+ * execution to the client of the request */
+struct job *submit_reader(struct request *request, struct statusrun *run) {
+    struct reader *rd;
+    struct job *ret;
+    rd = malloc(sizeof(struct reader));
+    if (! rd) return NULL;
+    ret = job_new(_run_reader, _free_reader, rd);
+    if (! ret) {
+        free(rd);
+        return NULL;
+    }
+    rd->config = request->config;
+    rd->fd = request->config->socket;
+    rd->uid = -1;
+    rd->replyto = request->addr;
+    rd->flags = request->cflags;
+    rd->run = run;
+    run->refcount++;
+    if (request->addr.addrlen) {
+        if (track_inflight(rd->config, request->creds.uid, 1) == -1) {
+            job_free(ret);
+            return NULL;
+        }
+        rd->uid = request->creds.uid;
+    }
+    ret->waitfor = run->pid;
+    jobqueue_append(request->config->jobs, ret);
+    return ret;
+}
+
+/* Send a successful completion message to a client and its followers */
+int reply_all(int fd, struct addr *addr, int flags,
+              struct follower *followers, int code) {
+    int ret = request_reply(fd, addr, flags, code);
+    for (; followers; followers = followers->next) {
+        if (! request_reply(fd, &followers->addr, followers->cflags, code))
+            ret = 0;
+    }
+    return ret;
+}
+
+/* Send an error message to a client and its followers */
+int senderr_all(int fd, struct addr *addr, int flags,
+                struct follower *followers, char *code, char *desc) {
+    int ret = 1;
+    if (addr->addrlen && comm_senderr(fd, code, desc, addr, flags) == -1)
+        ret = 0;
+    for (; followers; followers = followers->next) {
+        if (comm_senderr(fd, code, desc, &followers->addr,
+                         followers->cflags) == -1)
+            ret = 0;
+    }
+    return ret;
+}
+
 /* Schedule a job wrapping this request to be run */
 struct job *submit_waiter(struct request *request, int pid) {
     struct waiter *wt;
     struct job *ret;
     wt = malloc(sizeof(struct waiter));
     if (! wt) return NULL;
+    wt->config = request->config;
     wt->fd = request->config->socket;
     wt->pid = pid;
+    wt->program = request->program;
+    wt->action = request->action;
+    wt->plain = same_args(request->argv, NULL);
+    wt->uid = -1;
     wt->replyto = request->addr;
     wt->flags = request->cflags;
-    ret = job_new(_run_waiter, free, wt);
+    wt->stop = (request->action == request->program->act_stop &&
+                ! request->action->command);
+    wt->killed = 0;
+    ret = job_new(_run_waiter, _free_waiter, wt);
     if (! ret) {
         free(wt);
         return NULL;
     }
+    wt->program->refcount++;
+    if (request->addr.addrlen) {
+        if (track_inflight(wt->config, request->creds.uid, 1) == -1) {
+            job_free(ret);
+            return NULL;
+        }
+        wt->uid = request->creds.uid;
+    }
     ret->waitfor = pid;
     jobqueue_append(request->config->jobs, ret);
     return ret;
@@ -593,12 +1827,146 @@ struct job *submit_waiter(struct request *request, int pid) {
 /* Notify the process blocking on this waiter */
 int _run_waiter(void *data, int retcode) {
     struct waiter *wt = data;
+    char numbuf[64], *fields[] = { "OK", numbuf, NULL };
+    struct ctlmsg msg = CTLMSG_INIT;
     if (retcode == JOB_NOEXIT) {
         errno = EINVAL;
         return -1;
     }
-    return (request_reply(wt->fd, &wt->replyto, wt->flags,
-                          retcode)) ? 0 : -1;
+    if (! wt->stop)
+        return (request_reply(wt->fd, &wt->replyto, wt->flags,
+                              retcode)) ? 0 : -1;
+    /* Tell which signal the program has been stopped with */
+    if (! wt->replyto.addrlen) return 0;
+    snprintf(numbuf, sizeof(numbuf), "%d", retcode);
+    fields[2] = (wt->killed) ? "SIGKILL" : "SIGTERM";
+    msg.fields = fields;
+    msg.fieldnum = sizeof(fields) / sizeof(*fields);
+    return (comm_send(wt->fd, &msg, &wt->replyto, wt->flags) != -1) ? 0 : -1;
+}
+
+/* Collect the output of a finished status command (unless another reader
+ * has done so already), and relay it to the client */
+int _run_reader(void *data, int retcode) {
+    struct reader *rd = data;
+    struct statusrun *run = rd->run;
+    ssize_t len;
+    if (retcode == JOB_NOEXIT) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (! run->finished) {
+        run->output = malloc(STATUS_OUTPUT_MAX + 1);
+        if (run->output) {
+            len = pread(run->fd, run->output, STATUS_OUTPUT_MAX, 0);
+            run->output[(len > 0) ? len : 0] = '\0';
+        }
+        close(run->fd);
+        run->fd = -1;
+        run->pid = -1;
+        run->code = retcode;
+        run->finished = timestamp();
+    }
+    return (reply_output(rd->fd, &rd->replyto, rd->flags, run)) ? 0 : -1;
+}
+
+/* Release the status command execution referenced by a reader */
+void _free_reader(void *data) {
+    struct reader *rd = data;
+    track_inflight(rd->config, rd->uid, -1);
+    if (statusrun_del(rd->run)) free(rd->run);
+    free(rd);
+}
+
+/* Release the program reference held by a waiter */
+void _free_waiter(void *data) {
+    struct waiter *wt = data;
+    track_inflight(wt->config, wt->uid, -1);
+    if (prog_del(wt->program)) free(wt->program);
+    free(wt);
+}
+
+/* Finish the start of a program once it has settled (unless it has been
+ * started anew meanwhile) */
+int _run_settler(void *data, int retcode) {
+    struct settler *st = data;
+    /* The program might have been replaced by a reload meanwhile */
+    struct program *prog = config_get(st->config, st->program->name);
+    if (! prog) prog = st->program;
+    if (prog->startgen != st->startgen) return 0;
+    if (st->notify && prog->pid != -1) {
+        /* Not ready in time; the start finishes when the process is gone */
+        char msgbuf[256];
+        snprintf(msgbuf, sizeof(msgbuf), "Program '%.192s' not ready in "
+                 "time; killing", prog->name);
+        logmsg(WARN, msgbuf);
+        if (! senderr_all(st->config->socket, &st->replyto, st->flags,
+                          st->followers, "TIMEOUT", "Program did not "
+                          "become ready in time"))
+            return -1;
+        prog->flags |= PROG_TIMEDOUT;
+        signal_program(prog, SIGKILL);
+        return 0;
+    }
+    return (finish_start(st->config, prog) == -1) ? -1 : 0;
+}
+
+/* Kill a program that has not stopped in time (unless it has been started
+ * anew meanwhile) */
+int _run_killer(void *data, int retcode) {
+    struct settler *st = data;
+    struct waiter *wt;
+    struct job *job;
+    char msgbuf[256];
+    struct program *prog = config_get(st->config, st->program->name);
+    if (! prog) prog = st->program;
+    if (prog->startgen != st->startgen || prog->pid == -1) return 0;
+    snprintf(msgbuf, sizeof(msgbuf), "Program '%.192s' did not stop in "
+             "time; killing", prog->name);
+    logmsg(WARN, msgbuf);
+    /* Let the stop requests know */
+    for (job = st->config->jobs->head; job; job = job->next) {
+        if (job->callback != _run_waiter || job->waitfor != prog->pid)
+            continue;
+        wt = job->data;
+        wt->killed = 1;
+    }
+    if (signal_program(prog, SIGKILL) == -1)
+        logerr(ERROR, "Could not kill program");
+    return 0;
+}
+
+/* Restart a program that has missed its keepalive deadline (unless it has
+ * been started anew or exited meanwhile), or wait for the next deadline */
+int _run_watchdog(void *data, int retcode) {
+    struct settler *st = data;
+    struct request *req;
+    char msgbuf[256];
+    int res;
+    struct program *prog = config_get(st->config, st->program->name);
+    if (! prog) prog = st->program;
+    if (prog->startgen != st->startgen || prog->pid == -1 ||
+            ! prog->watchdog || st->config->shutdown)
+        return 0;
+    if (prog->wdeadline > timestamp())
+        return arm_watchdog(st->config, prog, st->startgen);
+    snprintf(msgbuf, sizeof(msgbuf), "Program '%.192s' missed its watchdog "
+             "deadline; restarting", prog->name);
+    logmsg(WARN, msgbuf);
+    req = request_synth(st->config, prog, "restart", NULL);
+    if (! req) return -1;
+    res = request_run(req);
+    request_free(req);
+    return (res == -1 && errno) ? -1 : 0;
+}
+
+/* Release the program reference held by a settler */
+void _free_settler(void *data) {
+    struct settler *st = data;
+    track_inflight(st->config, st->uid, -1);
+    free_followers(st->followers);
+    if (prog_del(st->program)) free(st->program);
+    free(st);
 }
 
 /* Execute the payload of the given request */
@@ -610,14 +1978,3 @@ int _run_request(void *data, int retcode) {
 void _free_request(void *data) {
     request_free(data);
 }
-
-/* Concatenate two strings */
-char *concat(char *s1, char *s2) {
-    int l1 = strlen(s1), l2 = strlen(s2);
-    char *r = malloc(l1 + l2 + 1);
-    if (! r) return NULL;
-    memcpy(r, s1, l1);
-    memcpy(r + l1, s2, l2);
-    r[l1 + l2] = '\0';
-    return r;
-}
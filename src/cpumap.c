@@ -0,0 +1,240 @@
+/* procmgr -- init-like process manager
+ * https://github.com/CylonicRaider/procmgr */
+
+#define _GNU_SOURCE
+#include <ctype.h>
+#include <dirent.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cpumap.h"
+
+/* Static functions */
+static int read_list(char *path, cpu_set_t *ret);
+static int read_int(char *path, int *ret);
+
+/* Read the CPU topology of the system */
+struct cpumap *cpumap_read(void) {
+    struct cpumap *ret;
+    struct dirent *ent;
+    cpu_set_t online;
+    char path[256];
+    int i, j, *corekeys = NULL;
+    DIR *dir;
+    /* Determine online CPUs */
+    if (! read_list(CPUMAP_SYSFS_CPU "/online", &online)) {
+        /* Fall back to the CPUs we may run on */
+        if (sched_getaffinity(0, sizeof(online), &online) == -1)
+            return NULL;
+    }
+    ret = calloc(1, sizeof(struct cpumap));
+    if (! ret) return NULL;
+    ret->count = CPU_COUNT(&online);
+    ret->nodes = 1;
+    ret->cpus = calloc(ret->count, sizeof(struct cpuinfo));
+    corekeys = calloc(ret->count, sizeof(int));
+    if (! ret->cpus || ! corekeys) goto error;
+    /* Identify cores; CPUs of the same core share the package and core IDs
+     * (the latter are only unique inside a package) */
+    for (i = 0, j = 0; i < CPU_SETSIZE && j < ret->count; i++) {
+        int package = 0, core = i, key, k;
+        if (! CPU_ISSET(i, &online)) continue;
+        snprintf(path, sizeof(path), CPUMAP_SYSFS_CPU
+                 "/cpu%d/topology/physical_package_id", i);
+        read_int(path, &package);
+        snprintf(path, sizeof(path), CPUMAP_SYSFS_CPU
+                 "/cpu%d/topology/core_id", i);
+        read_int(path, &core);
+        key = package << 16 | core;
+        for (k = 0; k < ret->cores; k++) {
+            if (corekeys[k] == key) break;
+        }
+        if (k == ret->cores) corekeys[ret->cores++] = key;
+        ret->cpus[j].cpu = i;
+        ret->cpus[j].core = k;
+        j++;
+    }
+    /* Assign NUMA nodes (if there are any) */
+    dir = opendir(CPUMAP_SYSFS_NODE);
+    if (dir) {
+        while ((ent = readdir(dir))) {
+            cpu_set_t nodecpus;
+            char *end;
+            int node;
+            if (strncmp(ent->d_name, "node", 4) != 0 ||
+                    ! isdigit(ent->d_name[4]))
+                continue;
+            node = strtol(ent->d_name + 4, &end, 10);
+            if (*end) continue;
+            snprintf(path, sizeof(path), CPUMAP_SYSFS_NODE "/node%d/cpulist",
+                     node);
+            if (! read_list(path, &nodecpus)) continue;
+            for (j = 0; j < ret->count; j++) {
+                if (CPU_ISSET(ret->cpus[j].cpu, &nodecpus))
+                    ret->cpus[j].node = node;
+            }
+            if (node >= ret->nodes) ret->nodes = node + 1;
+        }
+        closedir(dir);
+    }
+    free(corekeys);
+    return ret;
+    error:
+        free(corekeys);
+        cpumap_free(ret);
+        return NULL;
+}
+
+/* Free the given structure */
+void cpumap_free(struct cpumap *map) {
+    free(map->cpus);
+    free(map);
+}
+
+/* Choose count CPUs for a program */
+void cpumap_place(struct cpumap *map, int *load, int count, cpu_set_t *set) {
+    int i, n, best, node = -1, *coreload;
+    double score, bestscore = 0;
+    CPU_ZERO(set);
+    if (count > map->count) count = map->count;
+    /* Choose the least loaded node that can hold the program; if there is
+     * none, spread it over all of them */
+    for (n = 0; n < map->nodes; n++) {
+        int cpus = 0, sum = 0;
+        for (i = 0; i < map->count; i++) {
+            if (map->cpus[i].node != n) continue;
+            cpus++;
+            sum += load[i];
+        }
+        if (cpus < count || cpus == 0) continue;
+        score = (double) sum / cpus;
+        if (node == -1 || score < bestscore) {
+            node = n;
+            bestscore = score;
+        }
+    }
+    /* Sum up core loads (which simply remain zero if that fails) */
+    coreload = calloc(map->cores, sizeof(int));
+    if (coreload) {
+        for (i = 0; i < map->count; i++)
+            coreload[map->cpus[i].core] += load[i];
+    }
+    #define CORELOAD(i) ((coreload) ? coreload[map->cpus[i].core] : 0)
+    /* Pick the least loaded CPUs, preferring those on idle cores */
+    while (count--) {
+        best = -1;
+        for (i = 0; i < map->count; i++) {
+            if (CPU_ISSET(map->cpus[i].cpu, set)) continue;
+            if (node != -1 && map->cpus[i].node != node) continue;
+            if (best == -1 || load[i] < load[best] ||
+                    (load[i] == load[best] && CORELOAD(i) < CORELOAD(best)))
+                best = i;
+        }
+        if (best == -1) break;
+        CPU_SET(map->cpus[best].cpu, set);
+        load[best]++;
+        if (coreload) coreload[map->cpus[best].core]++;
+    }
+    #undef CORELOAD
+    free(coreload);
+}
+
+/* Restrict all threads of the process pid to the given set of CPUs */
+int cpuset_apply(int pid, cpu_set_t *set) {
+    struct dirent *ent;
+    char path[64], *end;
+    int tid, ret = 0;
+    DIR *dir;
+    snprintf(path, sizeof(path), "/proc/%d/task", pid);
+    dir = opendir(path);
+    if (! dir) return -1;
+    while ((ent = readdir(dir))) {
+        tid = strtol(ent->d_name, &end, 10);
+        if (! isdigit(*ent->d_name) || *end) continue;
+        if (sched_setaffinity(tid, sizeof(*set), set) == -1 &&
+                errno != ESRCH)
+            ret = -1;
+    }
+    closedir(dir);
+    return ret;
+}
+
+/* Parse a list of CPU numbers and ranges, like "0-3,8" */
+int cpuset_parse(cpu_set_t *ret, char *value) {
+    char *p = value, *end;
+    long from, to;
+    CPU_ZERO(ret);
+    do {
+        if (*p == ',') p++;
+        if (! isdigit(*p)) goto inval;
+        from = strtol(p, &end, 10);
+        to = from;
+        if (*end == '-') {
+            if (! isdigit(end[1])) goto inval;
+            to = strtol(end + 1, &end, 10);
+        }
+        if (from > to || to >= CPU_SETSIZE) goto inval;
+        for (; from <= to; from++) CPU_SET(from, ret);
+        p = end;
+    } while (*p == ',');
+    if (*p) goto inval;
+    return 1;
+    inval:
+        errno = EINVAL;
+        return 0;
+}
+
+/* Format the given set as a list of CPU numbers and ranges */
+char *cpuset_format(cpu_set_t *set, char *buf, int size) {
+    int i, j, len = 0;
+    *buf = '\0';
+    for (i = 0; i < CPU_SETSIZE && len < size; i = j) {
+        if (! CPU_ISSET(i, set)) {
+            j = i + 1;
+            continue;
+        }
+        for (j = i + 1; j < CPU_SETSIZE && CPU_ISSET(j, set); j++);
+        if (j - 1 == i) {
+            len += snprintf(buf + len, size - len, "%s%d",
+                            (len) ? "," : "", i);
+        } else {
+            len += snprintf(buf + len, size - len, "%s%d-%d",
+                            (len) ? "," : "", i, j - 1);
+        }
+    }
+    return buf;
+}
+
+/* Read a list of CPUs from the given file */
+int read_list(char *path, cpu_set_t *ret) {
+    char *line = NULL;
+    size_t size = 0;
+    ssize_t len;
+    int res = 0;
+    FILE *fp = fopen(path, "re");
+    if (! fp) return 0;
+    len = getline(&line, &size, fp);
+    if (len > 0 && line[len - 1] == '\n') line[--len] = '\0';
+    if (len == 0) {
+        /* E.g. memory-only NUMA nodes */
+        CPU_ZERO(ret);
+        res = 1;
+    } else if (len > 0) {
+        res = cpuset_parse(ret, line);
+    }
+    free(line);
+    fclose(fp);
+    return res;
+}
+
+/* Read an integer from the given file */
+int read_int(char *path, int *ret) {
+    FILE *fp = fopen(path, "re");
+    int res;
+    if (! fp) return 0;
+    res = (fscanf(fp, "%d", ret) == 1);
+    fclose(fp);
+    return res;
+}
@@ -0,0 +1,387 @@
+/* procmgr -- init-like process manager
+ * https://github.com/CylonicRaider/procmgr */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include "config.h"
+#include "control.h"
+#include "health.h"
+#include "launch.h"
+#include "logging.h"
+#include "util.h"
+
+/* Interval (in seconds) at which checks in progress are looked after */
+#define HEALTH_POLL 1
+
+/* Static definitions */
+struct checker {
+    struct config *config;
+    struct program *program;
+    int startgen;
+    int pid;
+};
+
+static int parse_address(char *target, struct sockaddr_storage *addr,
+                         socklen_t *addrlen);
+static struct job *submit_checker(struct config *config,
+                                  struct program *prog, int startgen,
+                                  int pid);
+static int check_begin(struct config *config, struct program *prog);
+static int check_poll(struct config *config, struct program *prog);
+static int check_result(struct config *config, struct program *prog,
+                        int healthy);
+static void check_abort(struct program *prog);
+static int spawn_check(struct config *config, struct program *prog);
+static int _run_checker(void *data, int retcode);
+static void _free_checker(void *data);
+
+/* Parse a health check specification */
+struct healthcheck *health_parse(char *value) {
+    struct healthcheck *ret;
+    struct sockaddr_storage addr;
+    socklen_t addrlen;
+    int type, len;
+    len = strcspn(value, " \t");
+    if (len == 4 && strncmp(value, "exec", 4) == 0) {
+        type = HEALTH_EXEC;
+    } else if (len == 7 && strncmp(value, "connect", 7) == 0) {
+        type = HEALTH_CONNECT;
+    } else if (len == 5 && strncmp(value, "mtime", 5) == 0) {
+        type = HEALTH_MTIME;
+    } else {
+        goto inval;
+    }
+    value += len;
+    value += strspn(value, " \t");
+    if (! *value) goto inval;
+    if (type == HEALTH_CONNECT && ! parse_address(value, &addr, &addrlen))
+        goto inval;
+    ret = malloc(sizeof(struct healthcheck));
+    if (! ret) return NULL;
+    ret->type = type;
+    ret->execpath = NULL;
+    ret->execargv = NULL;
+    ret->target = strdup(value);
+    if (! ret->target) {
+        free(ret);
+        return NULL;
+    }
+    ret->interval = HEALTH_INTERVAL;
+    ret->timeout = HEALTH_TIMEOUT;
+    ret->threshold = HEALTH_THRESHOLD;
+    return ret;
+    inval:
+        errno = EINVAL;
+        return NULL;
+}
+
+/* Free the given structure */
+void health_free(struct healthcheck *hc) {
+    if (! hc) return;
+    free(hc->target);
+    free(hc->execpath);
+    if (hc->execargv) {
+        char **p;
+        for (p = hc->execargv; *p; p++) free(*p);
+        free(hc->execargv);
+    }
+    free(hc);
+}
+
+/* Begin checking the health of the given program */
+int health_schedule(struct config *config, struct program *prog) {
+    struct healthstate *hs = &prog->hstate;
+    check_abort(prog);
+    hs->fails = 0;
+    hs->restarting = 0;
+    if (! prog->health) return 0;
+    hs->next = timestamp() + prog->health->interval;
+    return (submit_checker(config, prog, prog->startgen, -1)) ? 0 : -1;
+}
+
+/* Resolve a connect check target into a socket address
+ * Targets starting with a slash are UNIX domain socket paths; others are
+ * ports, optionally preceded by a numerical host address (IPv6 addresses
+ * in brackets) and a colon; the host defaults to the loopback address.
+ * Returns nonzero on success, or zero on error. */
+int parse_address(char *target, struct sockaddr_storage *addr,
+                  socklen_t *addrlen) {
+    struct addrinfo hints, *res;
+    char *buf, *host, *port;
+    int len, ok;
+    memset(addr, 0, sizeof(*addr));
+    if (*target == '/') {
+        struct sockaddr_un *sun = (struct sockaddr_un *) addr;
+        if (strlen(target) >= sizeof(sun->sun_path)) return 0;
+        sun->sun_family = AF_UNIX;
+        strcpy(sun->sun_path, target);
+        *addrlen = sizeof(struct sockaddr_un);
+        return 1;
+    }
+    buf = strdup(target);
+    if (! buf) return 0;
+    host = "127.0.0.1";
+    port = strrchr(buf, ':');
+    if (port) {
+        *port++ = '\0';
+        host = buf;
+        len = strlen(host);
+        if (len >= 2 && host[0] == '[' && host[len - 1] == ']') {
+            host[len - 1] = '\0';
+            host++;
+        }
+    } else {
+        port = buf;
+    }
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_NUMERICHOST | AI_NUMERICSERV;
+    ok = (getaddrinfo(host, port, &hints, &res) == 0);
+    free(buf);
+    if (! ok) return 0;
+    memcpy(addr, res->ai_addr, res->ai_addrlen);
+    *addrlen = res->ai_addrlen;
+    freeaddrinfo(res);
+    return 1;
+}
+
+/* Schedule a job looking after the health of the given program
+ * If pid is not -1, the job waits for the command of a HEALTH_EXEC check
+ * to finish; otherwise, it runs when the next check is due (or the check
+ * in progress is to be looked after). */
+struct job *submit_checker(struct config *config, struct program *prog,
+                           int startgen, int pid) {
+    struct healthstate *hs = &prog->hstate;
+    struct checker *ck;
+    struct job *ret;
+    ck = malloc(sizeof(struct checker));
+    if (! ck) return NULL;
+    ret = job_new(_run_checker, _free_checker, ck);
+    if (! ret) {
+        free(ck);
+        return NULL;
+    }
+    ck->config = config;
+    ck->program = prog;
+    ck->startgen = startgen;
+    ck->pid = pid;
+    prog->refcount++;
+    if (pid != -1) {
+        ret->waitfor = pid;
+    } else if (hs->fd != -1 || hs->pid != -1) {
+        ret->notBefore = timestamp() + HEALTH_POLL;
+    } else {
+        ret->notBefore = hs->next;
+    }
+    jobqueue_append(config->jobs, ret);
+    return ret;
+}
+
+/* Start a check of the given program
+ * Returns 1 if the program is being restarted, 0 if not, or -1 on error. */
+int check_begin(struct config *config, struct program *prog) {
+    struct healthcheck *hc = prog->health;
+    struct healthstate *hs = &prog->hstate;
+    struct sockaddr_storage addr;
+    socklen_t addrlen;
+    struct stat st;
+    double now = timestamp();
+    int fd;
+    hs->next = now + hc->interval;
+    hs->deadline = now + hc->timeout;
+    switch (hc->type) {
+        case HEALTH_EXEC:
+            hs->pid = spawn_check(config, prog);
+            if (hs->pid == -1) {
+                logerr(ERROR, "Could not run health check");
+                return check_result(config, prog, 0);
+            }
+            if (! submit_checker(config, prog, prog->startgen, hs->pid))
+                return -1;
+            return 0;
+        case HEALTH_CONNECT:
+            if (! parse_address(hc->target, &addr, &addrlen))
+                return check_result(config, prog, 0);
+            fd = socket(addr.ss_family, SOCK_STREAM | SOCK_NONBLOCK |
+                        SOCK_CLOEXEC, 0);
+            if (fd == -1) return check_result(config, prog, 0);
+            if (connect(fd, (struct sockaddr *) &addr, addrlen) == 0) {
+                close(fd);
+                return check_result(config, prog, 1);
+            } else if (errno == EINPROGRESS) {
+                hs->fd = fd;
+                return 0;
+            }
+            close(fd);
+            return check_result(config, prog, 0);
+        case HEALTH_MTIME:
+            return check_result(config, prog,
+                (stat(hc->target, &st) == 0 &&
+                 now - st.st_mtim.tv_sec - st.st_mtim.tv_nsec / 1e9 <=
+                     hc->timeout));
+    }
+    return 0;
+}
+
+/* Look after the check of the given program that is in progress
+ * Returns 1 if the program is being restarted, 0 if not, or -1 on error. */
+int check_poll(struct config *config, struct program *prog) {
+    struct healthstate *hs = &prog->hstate;
+    struct pollfd pfd;
+    socklen_t len;
+    int err, res;
+    if (hs->fd != -1) {
+        pfd.fd = hs->fd;
+        pfd.events = POLLOUT;
+        res = poll(&pfd, 1, 0);
+        if (res == 0 && timestamp() < hs->deadline) return 0;
+        len = sizeof(err);
+        if (res != 1 || getsockopt(hs->fd, SOL_SOCKET, SO_ERROR, &err,
+                                   &len) == -1)
+            err = ETIMEDOUT;
+        close(hs->fd);
+        hs->fd = -1;
+        return check_result(config, prog, (err == 0));
+    } else if (hs->pid != -1 && timestamp() >= hs->deadline) {
+        /* The waiting job records the failure */
+        kill(-hs->pid, SIGKILL);
+    }
+    return 0;
+}
+
+/* Record the outcome of a check of the given program, restarting it if it
+ * has failed too many checks in a row
+ * Returns 1 if the program is being restarted, 0 if not, or -1 on error. */
+int check_result(struct config *config, struct program *prog, int healthy) {
+    struct healthstate *hs = &prog->hstate;
+    struct request *req;
+    char msgbuf[256];
+    int res;
+    if (healthy) {
+        hs->fails = 0;
+        return 0;
+    }
+    hs->fails++;
+    snprintf(msgbuf, sizeof(msgbuf), "Program '%.192s' failed health check "
+             "(%d/%d)", prog->name, hs->fails, prog->health->threshold);
+    logmsg(NOTE, msgbuf);
+    if (hs->fails < prog->health->threshold) return 0;
+    snprintf(msgbuf, sizeof(msgbuf), "Program '%.192s' is unhealthy; "
+             "restarting", prog->name);
+    logmsg(WARN, msgbuf);
+    hs->fails = 0;
+    hs->restarting = 1;
+    req = request_synth(config, prog, "restart", NULL);
+    if (! req) return -1;
+    res = request_run(req);
+    request_free(req);
+    if (res == -1 && errno) return -1;
+    return 1;
+}
+
+/* Abandon the check of the given program that is in progress, if any */
+void check_abort(struct program *prog) {
+    struct healthstate *hs = &prog->hstate;
+    if (hs->fd != -1) {
+        close(hs->fd);
+        hs->fd = -1;
+    }
+    if (hs->pid != -1) {
+        kill(-hs->pid, SIGKILL);
+        hs->pid = -1;
+    }
+}
+
+/* Spawn the command of a HEALTH_EXEC check of the given program
+ * The command runs like the start action would (as far as credentials and
+ * the working directory are concerned) in its own process group, with its
+ * standard I/O streams redirected to /dev/null; the executable is taken
+ * from the cache of config.
+ * Returns the PID of the process, or -1 on error. */
+int spawn_check(struct config *config, struct program *prog) {
+    struct launch lch = LAUNCH_INIT;
+    struct healthcheck *hc = prog->health;
+    char namebuf[256], pidbuf[64];
+    char *argv[] = { ACTION_SHELL, "-c", hc->target, NULL };
+    char *envp[] = { "PATH=" ACTION_PATH, "SHELL=" ACTION_SHELL, namebuf,
+                     pidbuf, NULL };
+    int fd, ret;
+    snprintf(namebuf, sizeof(namebuf), "PROGNAME=%s", prog->name);
+    snprintf(pidbuf, sizeof(pidbuf), "PID=%d", prog->pid);
+    fd = open("/dev/null", O_RDWR | O_CLOEXEC);
+    if (fd == -1) return -1;
+    if (hc->execargv) {
+        lch.path = hc->execpath;
+        lch.argv = hc->execargv;
+    } else {
+        lch.path = ACTION_SHELL;
+        lch.argv = argv;
+    }
+    lch.execfd = execcache_get(&config->execs, lch.path);
+    lch.envp = envp;
+    lch.fds[0] = lch.fds[1] = lch.fds[2] = fd;
+    if (prog->act_start) {
+        lch.uid = prog->act_start->suid;
+        lch.gid = prog->act_start->sgid;
+    }
+    lch.cwd = prog->cwd;
+    lch.flags = LAUNCH_SETPGID;
+    ret = launch(&lch);
+    close(fd);
+    return ret;
+}
+
+/* Perform a due health check, look after one in progress, or process the
+ * outcome of a HEALTH_EXEC check */
+int _run_checker(void *data, int retcode) {
+    struct checker *ck = data;
+    struct healthstate *hs;
+    int res = 0;
+    /* The program might have been replaced by a reload meanwhile */
+    struct program *prog = config_get(ck->config, ck->program->name);
+    if (! prog) prog = ck->program;
+    hs = &prog->hstate;
+    if (ck->pid != -1) {
+        /* The command has finished (unless it has been abandoned) */
+        if (hs->pid != ck->pid) return 0;
+        hs->pid = -1;
+        if (prog->startgen != ck->startgen || hs->restarting) return 0;
+        return (check_result(ck->config, prog, (retcode == 0)) == -1) ?
+            -1 : 0;
+    }
+    if (prog->startgen != ck->startgen || prog->pid == -1 ||
+            ! prog->health || hs->restarting) {
+        check_abort(prog);
+        return 0;
+    }
+    if (hs->fd != -1 || hs->pid != -1) {
+        res = check_poll(ck->config, prog);
+    } else if (timestamp() >= hs->next &&
+               ! (prog->flags & (PROG_STARTING | PROG_STOPPING))) {
+        res = check_begin(ck->config, prog);
+    } else if (timestamp() >= hs->next) {
+        hs->next = timestamp() + prog->health->interval;
+    }
+    if (res == -1) return -1;
+    if (res == 1 || hs->restarting) return 0;
+    return (submit_checker(ck->config, prog, ck->startgen, -1)) ? 0 : -1;
+}
+
+/* Release the program reference held by a checker */
+void _free_checker(void *data) {
+    struct checker *ck = data;
+    if (prog_del(ck->program)) free(ck->program);
+    free(ck);
+}
@@ -63,8 +63,8 @@ void job_free(struct job *job) {
     }
     for (cur = job->next; cur; cur = next) {
         next = cur->next;
-        job_del(next);
-        free(next);
+        job_del(cur);
+        free(cur);
     }
     job_del(job);
     free(job);
@@ -104,12 +104,29 @@ void jobqueue_append(struct jobqueue *queue, struct job *job) {
     if (job->prev) job->prev->next = job;
 }
 
+/* Insert a job into the queue before another one */
+void jobqueue_insert(struct jobqueue *queue, struct job *before,
+                     struct job *job) {
+    if (! before) {
+        jobqueue_append(queue, job);
+        return;
+    }
+    job->prev = before->prev;
+    job->next = before;
+    before->prev = job;
+    if (job->prev) {
+        job->prev->next = job;
+    } else {
+        queue->head = job;
+    }
+}
+
 /* Extract the given job from the queue, and return it */
 struct job *jobqueue_take(struct jobqueue *queue, struct job *job) {
     if (queue->head == job) queue->head = job->next;
     if (queue->tail == job) queue->tail = job->prev;
-    if (queue->head) queue->head->prev = NULL;
-    if (queue->tail) queue->tail->next = NULL;
+    if (job->prev) job->prev->next = job->next;
+    if (job->next) job->next->prev = job->prev;
     job->prev = NULL;
     job->next = NULL;
     return job;
@@ -132,3 +149,16 @@ struct job *jobqueue_getfor(struct jobqueue *queue, int pid) {
     }
     return ret;
 }
+
+/* Return the earliest timestamp at which a job not waiting for a process
+ * becomes due */
+double jobqueue_due(struct jobqueue *queue) {
+    struct job *cur;
+    double ret = INFINITY;
+    for (cur = queue->head; cur; cur = cur->next) {
+        if (cur->waitfor != -1) continue;
+        if (isnan(cur->notBefore)) return timestamp();
+        if (cur->notBefore < ret) ret = cur->notBefore;
+    }
+    return ret;
+}
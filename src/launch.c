@@ -0,0 +1,680 @@
+/* procmgr -- init-like process manager
+ * https://github.com/CylonicRaider/procmgr */
+
+#define _GNU_SOURCE
+#include <ctype.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/prctl.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+
+#include "comm.h"
+#include "launch.h"
+
+/* Size of the stack children run on */
+#define STACK_SIZE 65536
+
+/* Only in recent kernel headers */
+#ifndef CLOSE_RANGE_CLOEXEC
+#define CLOSE_RANGE_CLOEXEC (1U << 2)
+#endif
+#ifndef CLONE_INTO_CGROUP
+#define CLONE_INTO_CGROUP 0x200000000ULL
+#endif
+/* Not wrapped by the C library */
+#define IOPRIO_WHO_PROCESS 1
+
+/* Arguments of clone3(), up to the cgroup member */
+struct clone3_args {
+    uint64_t flags;
+    uint64_t pidfd;
+    uint64_t child_tid;
+    uint64_t parent_tid;
+    uint64_t exit_signal;
+    uint64_t stack;
+    uint64_t stack_size;
+    uint64_t tls;
+    uint64_t set_tid;
+    uint64_t set_tid_size;
+    uint64_t cgroup;
+};
+
+/* Data passed to the child */
+struct childdata {
+    struct launch *launch;
+    sigset_t *sigmask;
+    int cgroupfd;
+    int migrate;
+    int migerr;
+};
+
+/* Static functions */
+static void spawner_main(int fd, int parent, char *cwd);
+static int spawner_run(struct ctlmsg *msg);
+static int parse_field(int *ret, char *value);
+static int clone_into_cgroup(struct childdata *data);
+static int launch_child(void *data);
+static int setup_fds(int *fds);
+static int apply_attrs(struct procattr *attr);
+static void child_error(char *what);
+
+/* Stack for children to run on
+ * Since the parent is suspended while a child uses it, one suffices. */
+static char child_stack[STACK_SIZE] __attribute__((aligned(16)));
+
+/* Spawn a child process as described by l */
+int launch(struct launch *l) {
+    struct childdata data;
+    sigset_t all, old;
+    int ret = -1, en;
+    /* Open the cgroup to create the child in */
+    data.cgroupfd = -1;
+    data.migrate = 0;
+    data.migerr = 0;
+    if (l->cgroup) {
+        data.cgroupfd = open(l->cgroup, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (data.cgroupfd == -1) return -2;
+    }
+    /* Block signals, so that no handler of ours runs in the child */
+    sigfillset(&all);
+    if (sigprocmask(SIG_SETMASK, &all, &old) == -1) goto end;
+    /* Create child; if the kernel cannot place it into its cgroup, it
+     * moves itself there */
+    data.launch = l;
+    data.sigmask = &old;
+    if (data.cgroupfd != -1) {
+        ret = clone_into_cgroup(&data);
+        data.migrate = (ret == -1 && (errno == ENOSYS || errno == E2BIG));
+        /* Failing to fork at all is not the cgroup's fault */
+        if (ret == -1 && ! data.migrate && errno != EAGAIN &&
+                errno != ENOMEM)
+            ret = -2;
+    }
+    if (data.cgroupfd == -1 || data.migrate) {
+        ret = clone(launch_child, child_stack + sizeof(child_stack),
+                    CLONE_VM | CLONE_VFORK | SIGCHLD |
+                    ((l->flags & LAUNCH_SIBLING) ? CLONE_PARENT : 0), &data);
+        /* The child shares our memory until it has executed or exited;
+         * it has exited already if it could not join its cgroup */
+        if (ret != -1 && data.migerr) {
+            errno = data.migerr;
+            ret = -2;
+        }
+    }
+    /* Restore signal mask */
+    en = errno;
+    sigprocmask(SIG_SETMASK, &old, NULL);
+    errno = en;
+    end:
+        if (data.cgroupfd != -1) {
+            en = errno;
+            close(data.cgroupfd);
+            errno = en;
+        }
+        return ret;
+}
+
+/* Obtain a descriptor of the executable at path from the given cache */
+int execcache_get(struct execfile **cache, char *path) {
+    struct execfile *cur;
+    struct stat st, pst;
+    int n = 0;
+    if (*path != '/') return -1;
+    for (cur = *cache; cur; cur = cur->next, n++) {
+        if (strcmp(cur->path, path) != 0) continue;
+        /* Re-open executables that the path does not lead to anymore
+         * (because they were removed or replaced, or a symlink on the way
+         * has been retargeted) */
+        if (cur->fd != -1 && fstat(cur->fd, &st) == 0 &&
+                stat(path, &pst) == 0 && st.st_dev == pst.st_dev &&
+                st.st_ino == pst.st_ino)
+            return cur->fd;
+        if (cur->fd != -1) close(cur->fd);
+        cur->fd = open(path, O_PATH | O_CLOEXEC);
+        return cur->fd;
+    }
+    if (n >= EXECCACHE_MAX) return -1;
+    cur = malloc(sizeof(struct execfile));
+    if (! cur) return -1;
+    cur->path = strdup(path);
+    cur->fd = open(path, O_PATH | O_CLOEXEC);
+    if (! cur->path || cur->fd == -1) {
+        if (cur->fd != -1) close(cur->fd);
+        free(cur->path);
+        free(cur);
+        return -1;
+    }
+    cur->next = *cache;
+    *cache = cur;
+    return cur->fd;
+}
+
+/* Close all descriptors in the given cache and empty it */
+void execcache_flush(struct execfile **cache) {
+    struct execfile *cur, *next;
+    for (cur = *cache; cur; cur = next) {
+        next = cur->next;
+        if (cur->fd != -1) close(cur->fd);
+        free(cur->path);
+        free(cur);
+    }
+    *cache = NULL;
+}
+
+/* Start a spawner process */
+int spawner_start(char *cwd) {
+    int sv[2], pid, parent = getpid();
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sv) == -1)
+        return -1;
+    pid = fork();
+    if (pid == -1) {
+        close(sv[0]);
+        close(sv[1]);
+        return -1;
+    } else if (pid == 0) {
+        close(sv[0]);
+        spawner_main(sv[1], parent, cwd);
+    }
+    close(sv[1]);
+    return sv[0];
+}
+
+/* Submit a child process to be spawned by the spawner connected to by fd */
+int launch_remote(int fd, struct launch *l) {
+    struct ctlmsg msg = CTLMSG_INIT;
+    char numbufs[4][32], attrbuf[sizeof(struct procattr) * 2 + 1], **p;
+    char closed[4], *cp = closed;
+    int i, n = 20, fill = -1;
+    /* The spawner runs executables by path; cached descriptors are not
+     * passed. The standard I/O descriptors can only be passed as a complete
+     * set; closed ones are listed in the "closed" field, and their slots
+     * are filled with one of the others. */
+    for (i = 0; i < 3; i++) {
+        if (l->fds[i] == -1) {
+            *cp++ = '0' + i;
+        } else if (fill == -1) {
+            fill = l->fds[i];
+        }
+    }
+    *cp = '\0';
+    if (fill != -1) {
+        for (i = 0; i < 3; i++)
+            msg.fds[i] = (l->fds[i] == -1) ? fill : l->fds[i];
+    }
+    /* Serialize description as key-value pairs */
+    if (l->argv) for (p = l->argv; *p; p++) n += 2;
+    if (l->envp) for (p = l->envp; *p; p++) n += 2;
+    msg.fields = calloc(n, sizeof(char *));
+    if (! msg.fields) return -1;
+    n = 0;
+    #define ADDFIELD(k, v) do { \
+        msg.fields[n++] = (k); \
+        msg.fields[n++] = (v); \
+    } while (0)
+    if (l->path) ADDFIELD("path", l->path);
+    if (l->argv) for (p = l->argv; *p; p++) ADDFIELD("arg", *p);
+    if (l->envp) for (p = l->envp; *p; p++) ADDFIELD("env", *p);
+    if (l->message) ADDFIELD("message", l->message);
+    if (l->cwd) ADDFIELD("cwd", l->cwd);
+    if (l->cgroup) ADDFIELD("cgroup", l->cgroup);
+    if (*closed) ADDFIELD("closed", closed);
+    if (l->attr) {
+        /* The spawner is the same program as we are, so the structure can
+         * be transferred verbatim */
+        unsigned char *src = (unsigned char *) l->attr;
+        for (i = 0; i < sizeof(struct procattr); i++)
+            sprintf(attrbuf + i * 2, "%02x", src[i]);
+        ADDFIELD("attr", attrbuf);
+    }
+    snprintf(numbufs[0], sizeof(numbufs[0]), "%d", l->exitcode);
+    ADDFIELD("exitcode", numbufs[0]);
+    snprintf(numbufs[1], sizeof(numbufs[1]), "%d", l->uid);
+    ADDFIELD("uid", numbufs[1]);
+    snprintf(numbufs[2], sizeof(numbufs[2]), "%d", l->gid);
+    ADDFIELD("gid", numbufs[2]);
+    snprintf(numbufs[3], sizeof(numbufs[3]), "%d", l->flags);
+    ADDFIELD("flags", numbufs[3]);
+    #undef ADDFIELD
+    msg.fieldnum = n;
+    /* Submit it; blocking here could deadlock with a spawner waiting for
+     * its replies to be collected */
+    n = comm_send(fd, &msg, NULL, COMM_DONTWAIT);
+    free(msg.fields);
+    if (n == -2) {
+        errno = EAGAIN;
+        return -1;
+    }
+    return (n == -1) ? -1 : 0;
+}
+
+/* Receive the outcome of the earliest launch submitted to the spawner
+ * connected to by fd */
+int launch_result(int fd, int *pid, int flags) {
+    struct ctlmsg msg = CTLMSG_INIT;
+    char *end;
+    int ret;
+    ret = comm_recv(fd, &msg, NULL, flags);
+    if (ret == -2) return 0;
+    if (ret == -1) return -1;
+    ret = -1;
+    if (msg.fieldnum == 0) {
+        /* End of file */
+        errno = EPIPE;
+    } else if (msg.fieldnum == 2 && strcmp(msg.fields[0], "OK") == 0) {
+        *pid = strtol(msg.fields[1], &end, 10);
+        if (*end || *pid <= 0) {
+            errno = EBADMSG;
+        } else {
+            ret = 1;
+        }
+    } else if ((msg.fieldnum == 2 || (msg.fieldnum == 3 &&
+                strcmp(msg.fields[2], "cgroup") == 0)) &&
+            strcmp(msg.fields[0], "FAIL") == 0) {
+        errno = strtol(msg.fields[1], &end, 10);
+        if (*end || errno <= 0) {
+            errno = EBADMSG;
+        } else {
+            *pid = (msg.fieldnum == 3) ? -2 : -1;
+            ret = 1;
+        }
+    } else {
+        errno = EBADMSG;
+    }
+    comm_del(&msg);
+    return ret;
+}
+
+/* Close all file descriptors not less than minfd */
+int close_from(int minfd, int lazy) {
+    char buf[1024];
+    struct dirent64 *ent;
+    int i, dfd, fd, len, ret = -1;
+#ifdef SYS_close_range
+    /* Marking the descriptors as close-on-exec is cheaper than closing them
+     * and equivalent for children that are about to exec(); older kernels
+     * do not support the flag, and even older ones the system call */
+    if (lazy &&
+            syscall(SYS_close_range, minfd, ~0U, CLOSE_RANGE_CLOEXEC) == 0)
+        return 0;
+    if (syscall(SYS_close_range, minfd, ~0U, 0) == 0)
+        return 0;
+#endif
+    /* Close all below 1024 */
+    for (i = minfd; i < 1024; i++) close(i);
+    /* Detect remaining FD-s from /proc */
+    dfd = open("/proc/self/fd", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dfd == -1) return -1;
+    for (;;) {
+        len = getdents64(dfd, buf, sizeof(buf));
+        if (len == -1) goto end;
+        if (len == 0) break;
+        for (i = 0; i < len; i += ent->d_reclen) {
+            char *p;
+            ent = (struct dirent64 *) (buf + i);
+            p = ent->d_name;
+            if (*p == '.') continue;
+            for (fd = 0; *p >= '0' && *p <= '9'; p++)
+                fd = fd * 10 + *p - '0';
+            if (*p) {
+                errno = EINVAL;
+                goto end;
+            }
+            if (fd < minfd || fd == dfd) continue;
+            close(fd);
+        }
+    }
+    ret = 0;
+    end:
+        close(dfd);
+        return ret;
+}
+
+/* Main loop of the spawner */
+void spawner_main(int fd, int parent, char *cwd) {
+    struct ctlmsg msg = CTLMSG_INIT;
+    struct sigaction act;
+    int res;
+    /* Reset signal handlers, and exit along with the daemon */
+    memset(&act, 0, sizeof(act));
+    act.sa_handler = SIG_DFL;
+    for (res = 1; res < NSIG; res++) sigaction(res, &act, NULL);
+    prctl(PR_SET_PDEATHSIG, SIGKILL);
+    if (getppid() != parent) _exit(0);
+    if (cwd && chdir(cwd) == -1) _exit(1);
+    /* Only retain the standard I/O streams and the socket */
+    if (dup2(fd, 3) == -1) _exit(1);
+    close_from(4, 0);
+    fd = 3;
+    /* Serve requests */
+    for (;;) {
+        res = comm_recv(fd, &msg, NULL, 0);
+        if (res == -1) {
+            if (errno == EINTR) continue;
+            _exit(1);
+        } else if (res == -2) {
+            continue;
+        } else if (res == 0) {
+            /* The daemon has gone away */
+            _exit(0);
+        }
+        res = spawner_run(&msg);
+        comm_del(&msg);
+        /* Every request is answered (in order) with either "OK <PID>" or
+         * "FAIL <errno>", the latter followed by "cgroup" if the child
+         * could not be placed into its cgroup */
+        {
+            char numbuf[32], *fields[] = { "OK", numbuf, "cgroup" };
+            msg.fieldnum = 2;
+            if (res < 0) {
+                fields[0] = "FAIL";
+                if (res == -2) msg.fieldnum = 3;
+                res = errno;
+            }
+            snprintf(numbuf, sizeof(numbuf), "%d", res);
+            msg.fields = fields;
+            res = comm_send(fd, &msg, NULL, 0);
+            msg.fieldnum = 0;
+            msg.fields = NULL;
+        }
+        if (res == -1) _exit(1);
+    }
+}
+
+/* Spawn a process as described by the given message from the daemon */
+int spawner_run(struct ctlmsg *msg) {
+    struct launch l = LAUNCH_INIT;
+    struct procattr attr;
+    int i, argc = 0, envc = 0, closed = 0, ret = -1;
+    /* Allocate arrays */
+    for (i = 0; i + 1 < msg->fieldnum; i += 2) {
+        if (strcmp(msg->fields[i], "arg") == 0) {
+            argc++;
+        } else if (strcmp(msg->fields[i], "env") == 0) {
+            envc++;
+        }
+    }
+    l.argv = calloc(argc + 1, sizeof(char *));
+    l.envp = calloc(envc + 1, sizeof(char *));
+    if (! l.argv || ! l.envp) goto end;
+    /* Deserialize description */
+    argc = 0;
+    envc = 0;
+    errno = 0;
+    for (i = 0; i + 1 < msg->fieldnum; i += 2) {
+        char *key = msg->fields[i], *value = msg->fields[i + 1];
+        if (strcmp(key, "path") == 0) {
+            l.path = value;
+        } else if (strcmp(key, "arg") == 0) {
+            l.argv[argc++] = value;
+        } else if (strcmp(key, "env") == 0) {
+            l.envp[envc++] = value;
+        } else if (strcmp(key, "message") == 0) {
+            l.message = value;
+        } else if (strcmp(key, "cwd") == 0) {
+            l.cwd = value;
+        } else if (strcmp(key, "cgroup") == 0) {
+            l.cgroup = value;
+        } else if (strcmp(key, "closed") == 0) {
+            /* Standard I/O streams to leave closed, as digits */
+            char *p;
+            for (p = value; *p; p++) {
+                if (*p < '0' || *p > '2') {
+                    errno = EINVAL;
+                    break;
+                }
+                closed |= 1 << (*p - '0');
+            }
+        } else if (strcmp(key, "attr") == 0) {
+            unsigned char *dest = (unsigned char *) &attr;
+            int j;
+            if (strlen(value) != sizeof(attr) * 2) errno = EINVAL;
+            for (j = 0; ! errno && j < sizeof(attr); j++) {
+                char hex[3] = { value[j * 2], value[j * 2 + 1], '\0' };
+                if (! isxdigit(hex[0]) || ! isxdigit(hex[1])) {
+                    errno = EINVAL;
+                    break;
+                }
+                dest[j] = strtol(hex, NULL, 16);
+            }
+            l.attr = &attr;
+        } else if (strcmp(key, "exitcode") == 0) {
+            parse_field(&l.exitcode, value);
+        } else if (strcmp(key, "uid") == 0) {
+            parse_field(&l.uid, value);
+        } else if (strcmp(key, "gid") == 0) {
+            parse_field(&l.gid, value);
+        } else if (strcmp(key, "flags") == 0) {
+            parse_field(&l.flags, value);
+        } else {
+            continue;
+        }
+        if (errno) goto end;
+    }
+    if (i != msg->fieldnum) {
+        errno = EINVAL;
+        goto end;
+    }
+    /* The descriptors received in the slots of closed streams are mere
+     * placeholders (and closed along with the message) */
+    for (i = 0; i < 3; i++)
+        l.fds[i] = (closed & 1 << i) ? -1 : msg->fds[i];
+    /* Spawn child as a sibling, i.e. as a child of the daemon */
+    l.flags |= LAUNCH_SIBLING;
+    ret = launch(&l);
+    end:
+        free(l.argv);
+        free(l.envp);
+        return ret;
+}
+
+/* Parse a decimal integer field of a message from the daemon
+ * Returns nonzero on success, or zero (with errno set to EINVAL) if value
+ * is empty, has trailing garbage, or is out of range. */
+int parse_field(int *ret, char *value) {
+    char *end;
+    long res;
+    errno = 0;
+    res = strtol(value, &end, 10);
+    if (errno || end == value || *end || res < INT_MIN || res > INT_MAX) {
+        errno = EINVAL;
+        return 0;
+    }
+    *ret = res;
+    return 1;
+}
+
+/* Create a child in the cgroup data->cgroupfd using clone3()
+ * The child does not share the address space of the caller, as it returns
+ * from the system call on the same stack as the caller; it calls
+ * launch_child() and never returns from here. */
+int clone_into_cgroup(struct childdata *data) {
+#ifdef SYS_clone3
+    struct clone3_args args;
+    long ret;
+    memset(&args, 0, sizeof(args));
+    /* Siblings inherit the exit signal of the caller (and specifying one
+     * explicitly is not allowed) */
+    args.flags = CLONE_INTO_CGROUP;
+    if (data->launch->flags & LAUNCH_SIBLING) {
+        args.flags |= CLONE_PARENT;
+    } else {
+        args.exit_signal = SIGCHLD;
+    }
+    args.cgroup = data->cgroupfd;
+    ret = syscall(SYS_clone3, &args, sizeof(args));
+    if (ret == 0) _exit(launch_child(data));
+    return ret;
+#else
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+/* Set up the child and execute its program */
+int launch_child(void *data) {
+    struct childdata *cd = data;
+    struct launch *l = cd->launch;
+    struct sigaction act;
+    int i;
+    /* Reset signal handlers (the table is not shared with the parent) and
+     * restore the signal mask */
+    memset(&act, 0, sizeof(act));
+    act.sa_handler = SIG_DFL;
+    for (i = 1; i < NSIG; i++) {
+        struct sigaction cur;
+        if (sigaction(i, NULL, &cur) == -1) continue;
+        if (cur.sa_handler == SIG_DFL || cur.sa_handler == SIG_IGN) continue;
+        sigaction(i, &act, NULL);
+    }
+    if (sigprocmask(SIG_SETMASK, cd->sigmask, NULL) == -1) {
+        child_error("sigprocmask");
+        _exit(LAUNCH_ESETUP);
+    }
+    /* Join cgroup if clone3() could not place us there */
+    if (cd->migrate) {
+        int fd = openat(cd->cgroupfd, "cgroup.procs", O_WRONLY | O_CLOEXEC);
+        if (fd == -1 || write(fd, "0", 1) == -1) {
+            cd->migerr = errno;
+            child_error("cgroup");
+            _exit(LAUNCH_ESETUP);
+        }
+        close(fd);
+    }
+    /* Open a new process group */
+    if (l->flags & LAUNCH_SETPGID && setpgid(0, 0) == -1) {
+        child_error("setpgid");
+        _exit(LAUNCH_ESETUP);
+    }
+    /* Configure file descriptors */
+    if (setup_fds(l->fds) == -1) {
+        child_error("fds");
+        _exit(LAUNCH_ESETUP);
+    }
+    /* Apply scheduling attributes and resource limits while we still have
+     * the privileges to */
+    if (l->attr && apply_attrs(l->attr) == -1) _exit(LAUNCH_ESETUP);
+    /* Drop privileges */
+    if (l->gid != -1 && setgid(l->gid) == -1) {
+        child_error("sgid");
+        _exit(LAUNCH_ESETUP);
+    }
+    if (l->uid != -1 && setuid(l->uid) == -1) {
+        child_error("suid");
+        _exit(LAUNCH_ESETUP);
+    }
+    /* Change working directory */
+    if (l->cwd && chdir(l->cwd) == -1) {
+        child_error("chdir");
+        _exit(LAUNCH_ESETUP);
+    }
+    /* Nothing to execute? */
+    if (! l->path) {
+        if (l->message) {
+            ssize_t res = write(1, l->message, strlen(l->message));
+            (void) res;
+        }
+        _exit(l->exitcode);
+    }
+    /* exec() program; scripts cannot be run via a close-on-exec
+     * descriptor, hence the fallback */
+    if (l->execfd != -1) {
+        fexecve(l->execfd, l->argv, l->envp);
+        if (errno != ENOENT) {
+            child_error("fexecve");
+            _exit(LAUNCH_EEXEC);
+        }
+    }
+    execve(l->path, l->argv, l->envp);
+    child_error("execve");
+    _exit(LAUNCH_EEXEC);
+}
+
+/* Set up file descriptors for running as a child */
+int setup_fds(int *fds) {
+    int i;
+    /* Override stdio with those given
+     * All descriptors of the daemon are close-on-exec; dup2() clears the
+     * flag on the copy, but does nothing if a descriptor is already in
+     * place. */
+    for (i = 0; i < 3; i++) {
+        if (fds[i] == -1) {
+            close(i);
+        } else if (fds[i] == i) {
+            if (fcntl(i, F_SETFD, 0) == -1) return -1;
+        } else if (dup2(fds[i], i) == -1) {
+            return -1;
+        }
+    }
+    return close_from(3, 1);
+}
+
+/* Apply the given scheduling attributes and resource limits to the calling
+ * process, reporting errors on stderr */
+int apply_attrs(struct procattr *attr) {
+    int i;
+    if (attr->flags & PROCATTR_CPUS &&
+            sched_setaffinity(0, sizeof(attr->cpus), &attr->cpus) == -1) {
+        child_error("cpus");
+        return -1;
+    }
+    if (attr->flags & PROCATTR_NICE &&
+            setpriority(PRIO_PROCESS, 0, attr->nice) == -1) {
+        child_error("nice");
+        return -1;
+    }
+    if (attr->flags & PROCATTR_IOPRIO &&
+            syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0,
+                    attr->ioprio) == -1) {
+        child_error("ioprio");
+        return -1;
+    }
+    if (attr->flags & PROCATTR_OOMADJ) {
+        /* Format the number without stdio */
+        char buf[16], *p = buf + sizeof(buf);
+        int fd, value = (attr->oomadj < 0) ? -attr->oomadj : attr->oomadj;
+        do {
+            *--p = '0' + value % 10;
+            value /= 10;
+        } while (value);
+        if (attr->oomadj < 0) *--p = '-';
+        fd = open("/proc/self/oom_score_adj", O_WRONLY | O_CLOEXEC);
+        if (fd == -1 || write(fd, p, buf + sizeof(buf) - p) == -1) {
+            child_error("oom-score-adj");
+            return -1;
+        }
+        close(fd);
+    }
+    for (i = 0; i < RLIM_NLIMITS; i++) {
+        if (! (attr->rlimset & 1 << i)) continue;
+        if (setrlimit(i, &attr->rlimits[i]) == -1) {
+            child_error("rlimit");
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/* Write an error message like perror() without using stdio */
+void child_error(char *what) {
+    char *desc = strerror(errno);
+    struct iovec iov[4];
+    iov[0].iov_base = what;
+    iov[0].iov_len = strlen(what);
+    iov[1].iov_base = ": ";
+    iov[1].iov_len = 2;
+    iov[2].iov_base = desc;
+    iov[2].iov_len = strlen(desc);
+    iov[3].iov_base = "\n";
+    iov[3].iov_len = 1;
+    if (writev(2, iov, 4) == -1) return;
+}
@@ -19,14 +19,35 @@
 
 #include "argparse.h"
 #include "control.h"
+#include "launch.h"
 #include "logging.h"
 #include "main.h"
 #include "util.h"
 
+/* Size of the buffers for program statuses in listings */
+#define STATBUF_SIZE 256
+
+/* Maximum amount of entries in a page of a listing */
+#define LIST_PAGE 1024
+
+/* Maximum amount of messages to receive before performing RUN requests */
+#define RECV_BATCH 64
+
+/* A RUN request received, but not performed yet
+ * Members:
+ * msg : (struct ctlmsg) The message.
+ * addr: (struct addr) The address it came from.
+ * next: (struct pending *) Linked list interconnection. */
+struct pending {
+    struct ctlmsg msg;
+    struct addr addr;
+    struct pending *next;
+};
+
 /* Usage and help */
 const char *USAGE = "USAGE: " PROGNAME " [-h|-V] [-c conffile] [-l log] [-L "
-    "level] [-P pidfile] [-d [-f] [-A autostart]|-t|-s|-r|-a [-0]] [program "
-    "action [args ...]]\n";
+    "level] [-P pidfile] [-d [-f] [-A autostart]|-t|-s|-r|-a [-S gen] [-0]] "
+    "[program action [args ...]]\n";
 const char *HELP =
     "-h: (--help) This help.\n"
     "-V: (--version) Print version (" VERSION ").\n"
@@ -48,6 +69,9 @@ const char *HELP =
     "-r: (--reload) Signal the daemon (if any running) to reload its\n"
     "    configuration.\n"
     "-a: (--all) List the status of all programs.\n"
+    "-S: (--since gen) List only the programs that have changed since the\n"
+    "    given generation (implies -a); the current generation is printed\n"
+    "    first.\n"
     "-0: (--null) Use NUL characters as list delimiters.\n"
     "If none of -dtsra are supplied, program and action must be present,\n"
     "and contain the program and action to invoke; additional command-line\n"
@@ -63,7 +87,7 @@ static int sigpipe[2] = { -1, -1 };
 struct config *create_config(char *filename) {
     struct config *config;
     struct conffile *conffile;
-    FILE *fp = fopen(filename, "r");
+    FILE *fp = fopen(filename, "re");
     if (! fp) return NULL;
     conffile = conffile_new(fp);
     if (! conffile) goto ferror;
@@ -150,8 +174,266 @@ static void notifier(int signum) {
     (void) res;
 }
 
+/* Create the notification socket if any program needs it and it does not
+ * exist yet
+ * Returns 0 on success (including if nothing is to be done), or -1 on
+ * error. */
+int server_notify(struct config *config) {
+    struct program *prog;
+    if (config->notify != -1) return 0;
+    for (prog = config->programs; prog; prog = prog->next) {
+        if (prog->notify || prog->watchdog) break;
+    }
+    if (! prog) return 0;
+    return (comm_listen_notify(config) == -1) ? -1 : 0;
+}
+
+/* Reply to a LIST request with a page of the listing
+ * Returns 0 on success (including non-fatal errors, which are reported to
+ * the client), or -1 on fatal error. */
+int server_list(struct config *config, struct ctlmsg *msg,
+                struct addr *addr) {
+    struct ctlmsg reply = CTLMSG_INIT;
+    struct program *p = config->programs;
+    struct tombstone *t = NULL;
+    unsigned long long since = 0, gen;
+    char *after = NULL, *end, **data, *statbufs, *name, *state, genbuf[32];
+    int i, l, size, used, delta = 0;
+    /* Parse options */
+    for (i = 1; i < msg->fieldnum; i++) {
+        if (strncmp(msg->fields[i], "after=", 6) == 0) {
+            after = msg->fields[i] + 6;
+        } else if (strncmp(msg->fields[i], "since=", 6) == 0) {
+            errno = 0;
+            since = strtoull(msg->fields[i] + 6, &end, 10);
+            if (errno || *end || end == msg->fields[i] + 6) break;
+            delta = 1;
+        } else {
+            break;
+        }
+    }
+    if (i < msg->fieldnum)
+        return (main_senderr(config, addr, "BADMSG", "Bad message")) ? 0 :
+            -1;
+    /* Changes since before the horizon (or since the future) cannot be
+     * told; the client gets a full listing instead */
+    gen = config_track(config);
+    if (delta && (since < config->horizon || since > gen)) delta = 0;
+    if (! delta) since = 0;
+    /* Resume after the last entry of the previous page; removed programs
+     * come after all others */
+    if (delta) t = config->tombstones;
+    if (after) {
+        p = config_get(config, after);
+        if (p) {
+            p = p->next;
+        } else {
+            for (; t && strcmp(t->name, after) != 0; t = t->next);
+            if (! t)
+                return (main_senderr(config, addr, "ESTALE", "Listing "
+                        "changed meanwhile")) ? 0 : -1;
+            t = t->next;
+        }
+    }
+    /* Allocate result array (and buffers for statuses including CPU
+     * placements) for one page */
+    data = calloc(LIST_PAGE * 2 + 4, sizeof(char *));
+    statbufs = malloc(MSG_MAXLEN);
+    if (! data || ! statbufs) {
+        logerr(FATAL, "Failed to allocate memory");
+        free(data);
+        free(statbufs);
+        return -1;
+    }
+    /* Drain as much data into it as fits into a message */
+    snprintf(genbuf, sizeof(genbuf), "gen=%llu", gen);
+    data[0] = "LISTING";
+    data[2] = genbuf;
+    data[3] = (delta) ? "delta" : "full";
+    l = 4;
+    size = sizeof("LISTING") + sizeof("more") + strlen(genbuf) + 1 +
+        sizeof("delta");
+    used = 0;
+    for (;;) {
+        /* Skip entries that have not changed */
+        while (p && p->changed <= since) p = p->next;
+        if (! p) while (t && t->gen <= since) t = t->next;
+        if ((! p && ! t) || l >= LIST_PAGE * 2 + 4) break;
+        if (p) {
+            /* The statuses fit into statbufs as long as size is within
+             * bounds */
+            int bufsize = MSG_MAXLEN - used;
+            if (bufsize > STATBUF_SIZE) bufsize = STATBUF_SIZE;
+            name = p->name;
+            state = prog_state(p, statbufs + used, bufsize);
+            if (p->pid != -1 && p->flags & PROG_PLACED) {
+                int n = strlen(state);
+                n += snprintf(state + n, bufsize - n, " cpus=");
+                if (n < bufsize)
+                    cpuset_format(&p->placed, state + n, bufsize - n);
+            }
+        } else {
+            name = t->name;
+            state = "removed";
+        }
+        i = strlen(name) + strlen(state) + 2;
+        if (size + i > MSG_MAXLEN) break;
+        data[l++] = name;
+        data[l++] = state;
+        size += i;
+        if (p) {
+            used += strlen(state) + 1;
+            p = p->next;
+        } else {
+            t = t->next;
+        }
+    }
+    /* Tell whether more is to come (unless nothing fits at all) */
+    data[1] = (p || t) ? "more" : "end";
+    if ((p || t) && l == 4) {
+        free(data);
+        free(statbufs);
+        return (main_senderr(config, addr, "E2BIG", "Listing entry too "
+                "long")) ? 0 : -1;
+    }
+    /* Send reply */
+    reply.fieldnum = l;
+    reply.fields = data;
+    i = comm_send(config->socket, &reply, addr, COMM_DONTWAIT);
+    if (i == -1) logerr(FATAL, "Failed to send message");
+    free(data);
+    free(statbufs);
+    return (i == -1) ? -1 : 0;
+}
+
+/* Act upon a message received by the server
+ * Returns 0 on success (including non-fatal errors, which are reported to
+ * the client), or -1 on fatal error. */
+int server_handle(struct config *config, struct ctlmsg *msg,
+                  struct addr *addr) {
+    char *fields[] = { NULL, NULL, NULL };
+    struct ctlmsg msg2 = CTLMSG_INIT;
+    if (msg->fieldnum == 0) {
+        /* No command? Cannot really do anything */
+        if (! main_senderr(config, addr, "NOMSG", "Empty message"))
+            return -1;
+    } else if (strcmp(msg->fields[0], "PING") == 0) {
+        /* Reply with a PONG */
+        if (msg->fieldnum > 2) {
+            if (! main_senderr(config, addr, "BADMSG", "Bad message"))
+                return -1;
+        } else if (msg->fieldnum == 2) {
+            fields[0] = "PONG";
+            fields[1] = msg->fields[1];
+        } else {
+            fields[0] = "PONG";
+        }
+    } else if (strcmp(msg->fields[0], "SIGNAL") == 0) {
+        /* Signal oneself, or fail */
+        if (msg->fieldnum != 2) {
+            if (! main_senderr(config, addr, "BADMSG", "Bad message"))
+                return -1;
+        } else if (msg->creds.uid != 0 &&
+                   msg->creds.uid != geteuid()) {
+            if (! main_senderr(config, addr, "EPERM",
+                    "Permission denied"))
+                return -1;
+        } else if (strcmp(msg->fields[1], "reload") == 0) {
+            char msgbuf[128];
+            snprintf(msgbuf, sizeof(msgbuf), "Reloading on behalf "
+                "of {PID=%d,UID=%d,GID=%d}", msg->creds.pid,
+                msg->creds.uid, msg->creds.gid);
+            logmsg(NOTE, msgbuf);
+            if (raise(SIGHUP) != 0) {
+                logerr(FATAL, "Could not signal oneself ?!");
+                return -1;
+            }
+            fields[0] = "OK";
+        } else if (strcmp(msg->fields[1], "shutdown") == 0) {
+            char msgbuf[128];
+            snprintf(msgbuf, sizeof(msgbuf), "Stopping on behalf "
+                "of {PID=%d,UID=%d,GID=%d}", msg->creds.pid,
+                msg->creds.uid, msg->creds.gid);
+            logmsg(NOTE, msgbuf);
+            if (raise(SIGTERM) != 0) {
+                logerr(FATAL, "Could not signal oneself ?!");
+                return -1;
+            }
+            fields[0] = "OK";
+        } else {
+            if (! main_senderr(config, addr, "BADMSG",
+                    "Bad message"))
+                return -1;
+        }
+        /* The signal handler will have only written to pipe, so we
+         * can reply safely. */
+    } else if (strcmp(msg->fields[0], "RUN") == 0) {
+        struct request *req;
+        char *reason;
+        int res;
+        /* Enforce rate limits before doing anything costly */
+        res = request_admit(config, msg->creds.uid, &reason);
+        if (res == -1) {
+            logerr(FATAL, "Failed to admit request");
+            return -1;
+        } else if (! res) {
+            if (! main_senderr(config, addr, "EBUSY", reason))
+                return -1;
+            return 0;
+        }
+        /* Create request */
+        req = request_new(config, msg, addr, COMM_DONTWAIT);
+        if (req == NULL) {
+            if (! errno) return 0;
+            logerr(FATAL, "Failed to create request");
+            return -1;
+        }
+        /* Validate it */
+        res = request_validate(req);
+        if (res == -1) {
+            logerr(FATAL, "Failed to validate request");
+            return -1;
+        }
+        if (! res) {
+            request_free(req);
+            if (! main_senderr(config, addr, "EPERM",
+                    "Permission denied"))
+                return -1;
+            return 0;
+        }
+        /* Drop a note */
+        log_request(req);
+        /* Act as appropriate */
+        if (request_run(req) == -1) {
+            logerr(FATAL, "Failed to process request");
+            return -1;
+        }
+        /* Dispose of request */
+        request_free(req);
+    } else if (strcmp(msg->fields[0], "LIST") == 0) {
+        /* Query status of (changed) programs */
+        if (server_list(config, msg, addr) == -1) return -1;
+    } else {
+        if (! main_senderr(config, addr, "BADCMD",
+                "No such command"))
+            return -1;
+    }
+    /* Common replying code */
+    if (fields[0]) {
+        msg2.fieldnum = 0;
+        while (fields[msg2.fieldnum]) msg2.fieldnum++;
+        msg2.fields = fields;
+        if (comm_send(config->socket, &msg2, addr,
+                      COMM_DONTWAIT) == -1) {
+            logerr(FATAL, "Failed to send message");
+            return -1;
+        }
+    }
+    return 0;
+}
+
 /* Server main loop */
-int server_main(struct config *config, int background, char *pidfile,
+int server_main(struct config *config, int readyfd, char *pidfile,
                 char *argv[]) {
     struct ctlmsg msg = CTLMSG_INIT;
     struct sigaction act;
@@ -163,7 +445,7 @@ int server_main(struct config *config, int background, char *pidfile,
         return 2;
     }
     /* Create communication pipe */
-    if (pipe(sigpipe) == -1) {
+    if (pipe2(sigpipe, O_CLOEXEC) == -1) {
         perror("Could not create pipe");
         return 1;
     }
@@ -187,14 +469,15 @@ int server_main(struct config *config, int background, char *pidfile,
         perror("Could not install signal handler");
         return 1;
     }
+    /* Restart delays are varied randomly */
+    srand48((long) (timestamp() * 1e6) ^ getpid());
     /* Create socket */
     if (comm_listen(config) == -1) {
         perror("Could not create socket");
         return 1;
     }
-    /* Go into background */
-    if (background && daemonize() == -1) {
-        perror("Failed to go into background");
+    if (server_notify(config) == -1) {
+        perror("Could not create notification socket");
         return 1;
     }
     /* Write PID file */
@@ -204,7 +487,7 @@ int server_main(struct config *config, int background, char *pidfile,
         memset(pidbuf, 0, sizeof(pidbuf));
         snprintf(pidbuf, sizeof(pidbuf), "%d\n", getpid());
         pidbuf[sizeof(pidbuf) - 1] = '\0';
-        pidf = open(pidfile, O_WRONLY | O_CREAT, 0644);
+        pidf = open(pidfile, O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
         if (pidf == -1) {
             logerr(ERROR, "Could not open PID file");
         } else {
@@ -215,13 +498,22 @@ int server_main(struct config *config, int background, char *pidfile,
             close(pidf);
         }
     }
+    /* Create status page */
+    if (config->statuspath) {
+        config->statuspage = statuspage_open(config->statuspath);
+        if (! config->statuspage)
+            logerr(ERROR, "Could not create status page");
+    }
     /* Final preparations */
-    FD_ZERO(&readfds);
+    if (readyfd != -1 && daemonize_done(readyfd, 0) == -1)
+        logerr(ERROR, "Failed to finish going into background");
     logmsg(NOTE, PROGNAME " started");
     /* Schedule autostarts */
     if (config->autostart) {
         int progs = 0;
         struct program *prog;
+        /* Queue all starts, so that they are performed by priority */
+        config->holdstarts = 1;
         for (prog = config->programs; prog; prog = prog->next) {
             if (prog->autostart == config->autostart) {
                 struct request *req = request_synth(config, prog, "start",
@@ -239,19 +531,39 @@ int server_main(struct config *config, int background, char *pidfile,
                 progs++;
             }
         }
+        config->holdstarts = 0;
+        if (run_starts(config) == -1) {
+            logerr(FATAL, "Failed to process request");
+            return 1;
+        }
         if (progs) logmsg(NOTE, "Autostart finished");
     }
     /* Main loop */
     for (;;) {
         int nfds, res;
         struct timeval timeout;
-        /* Prepare for select() */
+        double due;
+        /* Publish the state of the programs */
+        if (config->statuspage &&
+                statuspage_update(config->statuspage, config) == -1)
+            logerr(ERROR, "Could not update status page");
+        /* Prepare for select(); the spawner may have been dropped since
+         * the last call */
+        FD_ZERO(&readfds);
         FD_SET(config->socket, &readfds);
+        if (config->notify != -1) FD_SET(config->notify, &readfds);
+        if (config->spawner != -1) FD_SET(config->spawner, &readfds);
         FD_SET(sigpipe[0], &readfds);
         nfds = (config->socket > sigpipe[0]) ? config->socket : sigpipe[0];
+        if (config->notify > nfds) nfds = config->notify;
+        if (config->spawner > nfds) nfds = config->spawner;
         nfds++;
-        timeout.tv_sec = 1;
-        timeout.tv_usec = 0;
+        /* Wake up for the next due job, but at least once a second */
+        due = jobqueue_due(config->jobs) - timestamp();
+        if (due > 1) due = 1;
+        if (due < 0) due = 0;
+        timeout.tv_sec = (long) due;
+        timeout.tv_usec = (long) ((due - timeout.tv_sec) * 1e6);
         /* Determine which event to check now */
         res = select(nfds, &readfds, NULL, NULL, &timeout);
         if (res == -1) {
@@ -262,6 +574,12 @@ int server_main(struct config *config, int background, char *pidfile,
                 return 1;
             }
         }
+        /* Collect the PIDs of processes spawned by the spawner */
+        if (config->spawner != -1 && FD_ISSET(config->spawner, &readfds) &&
+                handle_spawns(config, 0) == -1) {
+            logerr(FATAL, "Failed to process request");
+            return 1;
+        }
         /* Check for signals */
         if (FD_ISSET(sigpipe[0], &readfds)) {
             unsigned char signo;
@@ -273,14 +591,30 @@ int server_main(struct config *config, int background, char *pidfile,
             if (signo == SIGHUP) {
                 /* Reload configuration */
                 logmsg(NOTE, "Reloading configuration...");
-                config_update(config, 0);
-                logmsg(INFO, "Done");
+                if (config_update(config, 0) < 0) {
+                    logerr(ERROR, "Could not reload configuration; keeping "
+                           "the current programs");
+                } else {
+                    if (server_notify(config) == -1)
+                        logerr(ERROR, "Could not create notification "
+                               "socket");
+                    if (place_programs(config, NULL) == -1)
+                        logerr(ERROR, "Could not place programs on CPUs");
+                    logmsg(INFO, "Done");
+                }
             } else if (signo == SIGINT || signo == SIGTERM) {
                 /* Shut down */
-                logmsg(WARN, "Exiting!");
-                break;
+                if (config->shutdownmode == SHUTDOWN_LEAVE) {
+                    logmsg(WARN, "Exiting!");
+                    break;
+                }
+                if (begin_shutdown(config) == -1) {
+                    logerr(FATAL, "Failed to shut down");
+                    return 1;
+                }
             } else if (signo == SIGCHLD) {
-                int pid, status, retcode;
+                int pid, status, retcode, restart;
+                double delay;
                 /* Wait for children */
                 for (;;) {
                     struct program *prog;
@@ -301,22 +635,57 @@ int server_main(struct config *config, int background, char *pidfile,
                     } else {
                         continue;
                     }
-                    /* Obtain program */
+                    /* Obtain program; an unknown child might not have
+                     * been reported by the spawner yet */
                     prog = config_getpid(config, pid);
+                    if (! prog && config->spawns->head) {
+                        if (handle_spawns(config, 1) == -1) {
+                            logerr(FATAL, "Failed to process request");
+                            goto commerr;
+                        }
+                        prog = config_getpid(config, pid);
+                    }
+                    restart = (prog && prog->flags & PROG_RUNNING &&
+                               (prog->delay > 0 ||
+                                prog->flags & PROG_TIMEDOUT));
+                    delay = (restart) ? restart_backoff(prog) : -1;
                     if (prog) {
                         char msgbuf[320];
-                        snprintf(msgbuf, sizeof(msgbuf),
-                            "Program '%.192s' (%d) exit with status %d%s",
-                            prog->name, prog->pid, retcode,
-                            (prog->delay > 0 && prog->flags & PROG_RUNNING) ?
-                                "; will restart" : "");
-                        logmsg(NOTE, msgbuf);
+                        if (delay >= 0) {
+                            snprintf(msgbuf, sizeof(msgbuf),
+                                "Program '%.192s' (%d) exit with status %d; "
+                                "will restart in %.1fs", prog->name,
+                                prog->pid, retcode, delay);
+                        } else {
+                            snprintf(msgbuf, sizeof(msgbuf),
+                                "Program '%.192s' (%d) exit with status %d%s",
+                                prog->name, prog->pid, retcode,
+                                (restart) ? "; restarted too often, "
+                                    "quarantined" : "");
+                        }
+                        logmsg((restart && delay < 0) ? WARN : NOTE, msgbuf);
+                        if (prog->flags & PROG_STOPPING) {
+                            snprintf(msgbuf, sizeof(msgbuf), "Program "
+                                "'%.192s' stopped after %.3fs", prog->name,
+                                timestamp() - prog->stopped);
+                            logmsg(INFO, msgbuf);
+                        }
                         prog->pid = -1;
+                        prog->exitcode = retcode;
+                        prog->exited = timestamp();
+                        if (finish_start(config, prog) == -1) {
+                            logerr(FATAL, "Failed to process request");
+                            goto commerr;
+                        }
+                        /* Redistribute the CPUs it occupied */
+                        if (prog->flags & PROG_PLACED &&
+                                place_programs(config, NULL) == -1)
+                            logerr(ERROR, "Could not place programs on CPUs");
                     }
                     /* Run jobs */
                     run_jobs(config, pid, retcode);
                     if (prog) {
-                        if (prog->delay > 0 && prog->flags & PROG_RUNNING) {
+                        if (delay >= 0) {
                             /* Restart automatically, if applicable */
                             struct request *req = request_synth(config, prog,
                                 "start", NULL);
@@ -326,7 +695,7 @@ int server_main(struct config *config, int background, char *pidfile,
                             }
                             req->flags |= REQUEST_DIHNTR;
                             if (! request_schedule(req, timestamp() +
-                                                prog->delay)) {
+                                                   delay)) {
                                 request_free(req);
                                 logerr(FATAL, "Failed to schedule request");
                                 goto commerr;
@@ -340,166 +709,60 @@ int server_main(struct config *config, int background, char *pidfile,
                 }
             }
         }
-        /* Receive message */
+        /* Receive readiness notifications */
+        if (config->notify != -1 && FD_ISSET(config->notify, &readfds) &&
+                handle_notify(config) == -1)
+            logerr(ERROR, "Failed to receive notification");
+        /* Receive messages; cheap queries are answered as they arrive,
+         * while RUN requests (which might spawn processes) are deferred
+         * until the socket is drained (or RECV_BATCH messages have been
+         * read) */
         if (FD_ISSET(config->socket, &readfds)) {
-            char *fields[] = { NULL, NULL, NULL };
-            struct ctlmsg msg2 = CTLMSG_INIT;
+            struct pending *runs = NULL, **tail = &runs, *cur;
             struct addr addr;
-            int res = comm_recv(config->socket, &msg, &addr, COMM_DONTWAIT);
-            if (res == -2) continue;
-            if (res == -1) {
-                logerr(FATAL, "Failed to receive message");
-                return 1;
-            }
-            /* Reject non-repliable messages */
-            if (addr.addrlen < sizeof(sa_family_t) ||
-                addr.addr.sun_family == AF_UNSPEC) continue;
-            /* Act upon them */
-            if (msg.fieldnum == 0) {
-                /* No command? Cannot really do anything */
-                if (! main_senderr(config, &addr, "NOMSG", "Empty message"))
-                    goto commerr;
-            } else if (strcmp(msg.fields[0], "PING") == 0) {
-                /* Reply with a PONG */
-                if (msg.fieldnum > 2) {
-                    if (! main_senderr(config, &addr, "BADMSG", "Bad message"))
-                        goto commerr;
-                } else if (msg.fieldnum == 2) {
-                    fields[0] = "PONG";
-                    fields[1] = msg.fields[1];
-                } else {
-                    fields[0] = "PONG";
-                }
-            } else if (strcmp(msg.fields[0], "SIGNAL") == 0) {
-                /* Signal oneself, or fail */
-                if (msg.fieldnum != 2) {
-                    if (! main_senderr(config, &addr, "BADMSG", "Bad message"))
-                        goto commerr;
-                } else if (msg.creds.uid != 0 &&
-                           msg.creds.uid != geteuid()) {
-                    if (! main_senderr(config, &addr, "EPERM",
-                            "Permission denied"))
-                        goto commerr;
-                } else if (strcmp(msg.fields[1], "reload") == 0) {
-                    char msgbuf[128];
-                    snprintf(msgbuf, sizeof(msgbuf), "Reloading on behalf "
-                        "of {PID=%d,UID=%d,GID=%d}", msg.creds.pid,
-                        msg.creds.uid, msg.creds.gid);
-                    logmsg(NOTE, msgbuf);
-                    if (raise(SIGHUP) != 0) {
-                        logerr(FATAL, "Could not signal oneself ?!");
-                        goto commerr;
-                    }
-                    fields[0] = "OK";
-                } else if (strcmp(msg.fields[1], "shutdown") == 0) {
-                    char msgbuf[128];
-                    snprintf(msgbuf, sizeof(msgbuf), "Stopping on behalf "
-                        "of {PID=%d,UID=%d,GID=%d}", msg.creds.pid,
-                        msg.creds.uid, msg.creds.gid);
-                    logmsg(NOTE, msgbuf);
-                    if (raise(SIGTERM) != 0) {
-                        logerr(FATAL, "Could not signal oneself ?!");
-                        goto commerr;
-                    }
-                    fields[0] = "OK";
-                } else {
-                    if (! main_senderr(config, &addr, "BADMSG",
-                            "Bad message"))
-                        goto commerr;
-                }
-                /* The signal handler will have only written to pipe, so we
-                 * can reply safely. */
-            } else if (strcmp(msg.fields[0], "RUN") == 0) {
-                int res;
-                /* Create request */
-                struct request *req = request_new(config, &msg, &addr,
-                                                  COMM_DONTWAIT);
-                if (req == NULL) {
-                    if (! errno) continue;
-                    logerr(FATAL, "Failed to create request");
-                    goto commerr;
-                }
-                /* Validate it */
-                res = request_validate(req);
+            int n, failed = 0;
+            for (n = 0; n < RECV_BATCH; n++) {
+                res = comm_recv(config->socket, &msg, &addr, COMM_DONTWAIT);
+                if (res == -2) break;
                 if (res == -1) {
-                    logerr(FATAL, "Failed to validate request");
-                    goto commerr;
+                    logerr(FATAL, "Failed to receive message");
+                    failed = 1;
+                    break;
                 }
-                if (! res) {
-                    if (! main_senderr(config, &addr, "EPERM",
-                            "Permission denied"))
-                        goto commerr;
-                    goto msgend;
-                }
-                /* Drop a note */
-                log_request(req);
-                /* Act as appropriate */
-                if (request_run(req) == -1) {
-                    logerr(FATAL, "Failed to process request");
-                    goto commerr;
-                }
-                /* Dispose of request */
-                request_free(req);
-            } else if (strcmp(msg.fields[0], "LIST") == 0) {
-                struct program *p;
-                int l = 1;
-                char **data;
-                /* Query status of all programs */
-                if (msg.fieldnum != 1) {
-                    if (! main_senderr(config, &addr, "BADMSG", "Bad message"))
-                        goto commerr;
-                    goto msgend;
-                }
-                /* Allocate result array */
-                for (p = config->programs; p; p = p->next) l++;
-                l *= 2;
-                data = calloc(l, sizeof(char *));
-                if (! data) {
-                    logerr(FATAL, "Failed to allocate memory");
-                    goto commerr;
-                }
-                /* Drain data into it */
-                data[0] = "LISTING";
-                l = 1;
-                for (p = config->programs; p; p = p->next, l += 2) {
-                    data[l] = p->name;
-                    if (p->flags & PROG_REMOVE) {
-                        data[l + 1] = (p->pid == -1) ? "dead lingering ?!" :
-                            "running lingering";
-                    } else {
-                        data[l + 1] = (p->pid == -1) ? "dead" : "running";
+                /* Reject non-repliable messages */
+                if (addr.addrlen < sizeof(sa_family_t) ||
+                    addr.addr.sun_family == AF_UNSPEC) continue;
+                if (msg.fieldnum && strcmp(msg.fields[0], "RUN") == 0) {
+                    cur = malloc(sizeof(struct pending));
+                    if (! cur) {
+                        logerr(FATAL, "Failed to allocate memory");
+                        failed = 1;
+                        break;
                     }
+                    cur->msg = msg;
+                    cur->addr = addr;
+                    cur->next = NULL;
+                    *tail = cur;
+                    tail = &cur->next;
+                    msg = (struct ctlmsg) CTLMSG_INIT;
+                    continue;
                 }
-                /* Send reply */
-                msg2.fieldnum = l;
-                msg2.fields = data;
-                if (comm_send(config->socket, &msg2, &addr,
-                              COMM_DONTWAIT) == -1) {
-                    logerr(FATAL, "Failed to send message");
-                    free(data);
-                    goto commerr;
+                if (server_handle(config, &msg, &addr) == -1) {
+                    failed = 1;
+                    break;
                 }
-                /* Clean up */
-                free(data);
-            } else {
-                if (! main_senderr(config, &addr, "BADCMD",
-                        "No such command"))
-                    goto commerr;
+                comm_del(&msg);
             }
-            /* Common replying code */
-            if (fields[0]) {
-                msg2.fieldnum = 0;
-                while (fields[msg2.fieldnum]) msg2.fieldnum++;
-                msg2.fields = fields;
-                if (comm_send(config->socket, &msg2, &addr,
-                              COMM_DONTWAIT) == -1) {
-                    logerr(FATAL, "Failed to send message");
-                    goto commerr;
-                }
+            /* Perform the requests deferred */
+            for (; runs; runs = cur) {
+                cur = runs->next;
+                if (! failed && server_handle(config, &runs->msg,
+                                              &runs->addr) == -1)
+                    failed = 1;
+                comm_del(&runs->msg);
+                free(runs);
             }
-            /* Clean message */
-            msgend:
-                comm_del(&msg);
+            if (failed) goto commerr;
         }
         /* Run unbound jobs */
         do {
@@ -509,6 +772,20 @@ int server_main(struct config *config, int background, char *pidfile,
                 return 1;
             }
         } while (res);
+        /* Continue shutting down */
+        if (config->shutdown) {
+            res = shutdown_step(config);
+            if (res == -1) {
+                logerr(FATAL, "Failed to shut down");
+                return 1;
+            } else if (res == 0) {
+                char msgbuf[128];
+                snprintf(msgbuf, sizeof(msgbuf), "Exiting after shutting "
+                         "down for %.3fs", timestamp() - config->shutdown);
+                logmsg(WARN, msgbuf);
+                break;
+            }
+        }
     }
     /* Everything went well. :) */
     ret = 0;
@@ -566,18 +843,21 @@ int client_main(struct config *config, struct client_action action,
         perror("Could not connect");
         return 1;
     }
-    /* Send command */
-    res = send_request(config, data, 0);
-    if (action.action == SPAWN) free(data);
-    if (res == 0) {
-        fprintf(stderr, "Invalid arguments\n");
-        return 2;
-    } else if (res == -1) {
-        perror("Error while sending command");
-        return 1;
+    /* Send command and obtain reply (listings can take multiple rounds) */
+    if (action.action == LIST) {
+        res = get_listing(config, &replydata, action.since, 0);
+    } else {
+        res = send_request(config, data, 0);
+        if (action.action == SPAWN) free(data);
+        if (res == 0) {
+            fprintf(stderr, "Invalid arguments\n");
+            return 2;
+        } else if (res == -1) {
+            perror("Error while sending command");
+            return 1;
+        }
+        res = get_reply(config, &replydata, 0);
     }
-    /* Obtain reply */
-    res = get_reply(config, &replydata, 0);
     if (res == REPLY_ERROR) {
         if (errno) perror("Error while receiving reply");
         res = 1;
@@ -595,25 +875,46 @@ int client_main(struct config *config, struct client_action action,
             res = 1;
             goto end;
         }
-        /* Print listing */
+        /* Print listing (after the generation, if that is of interest) */
         if (! (action.flags & CLIENTACT_NULSEP)) {
             /* Calculate display width */
-            int w = 0;
-            for (l = 1; l < replydata.len; l += 2) {
+            int w = (action.since) ? strlen("generation") : 0;
+            for (l = 3; l < replydata.len; l += 2) {
                 int ll = strlen(replydata.data[l]);
                 if (ll > w) w = ll;
             }
             /* Write columns */
-            for (l = 1; l < replydata.len; l += 2) {
+            if (action.since)
+                printf("%-*s: %s %s\n", w, "generation",
+                       replydata.data[1] + 4, replydata.data[2]);
+            for (l = 3; l < replydata.len; l += 2) {
                 printf("%-*s: %s\n", w, replydata.data[l],
                        replydata.data[l + 1]);
             }
         } else {
-            for (l = 1; l < replydata.len; l++) {
+            if (action.since)
+                printf("generation%c%s %s%c", '\0', replydata.data[1] + 4,
+                       replydata.data[2], '\0');
+            for (l = 3; l < replydata.len; l++) {
                 fputs(replydata.data[l], stdout);
                 putchar('\0');
             }
         }
+    } else if (replydata.len >= 3 && strcmp(replydata.data[0], "OK") == 0 &&
+               strncmp(replydata.data[2], "state=", 6) == 0) {
+        /* Inline status reply */
+        printf((res == 0) ? "running\n" : "not running\n");
+        fflush(stdout);
+    } else if (replydata.len >= 3 && strcmp(replydata.data[0], "OK") == 0 &&
+               strncmp(replydata.data[2], "output=", 7) == 0) {
+        /* Captured status command output */
+        fputs(replydata.data[2] + 7, stdout);
+        fflush(stdout);
+    } else if (replydata.len >= 3 && strcmp(replydata.data[0], "OK") == 0 &&
+               strcmp(replydata.data[2], "SIGKILL") == 0) {
+        /* Stopped, but not gracefully */
+        fprintf(stderr, "NOTE: Program did not stop in time and has been "
+                "killed\n");
     }
     end:
         /* Clean up */
@@ -626,12 +927,12 @@ int client_main(struct config *config, struct client_action action,
 
 /* Main function */
 int main(int argc, char *argv[]) {
-    int server = 0, background = -1, ret;
+    int server = 0, background = -1, readyfd = -1, spawner = -1, ret;
     char *conffile = NULL, *pidfile = NULL, **args = NULL;
     FILE *logfp = NULL;
     char *logslevel = NULL, *logfacility = NULL;
-    int logilevel = NOTE, autostart = -1;
-    struct client_action action = { SPAWN, 0 };
+    int logilevel = NOTE, autostart = -1, spawnerr = 0;
+    struct client_action action = { SPAWN, 0, NULL };
     struct opt opts;
     struct logging_syslog syslogopts;
     struct config *config;
@@ -711,6 +1012,14 @@ int main(int argc, char *argv[]) {
                 action.action = RELOAD;
             } else if (strcmp(arg, "all") == 0) {
                 action.action = LIST;
+            } else if (strcmp(arg, "since") == 0) {
+                action.action = LIST;
+                action.since = getarg(&opts, 0);
+                if (! action.since) {
+                    fprintf(stderr, "Missing required argument for '--%s'\n",
+                            arg);
+                    usage(0, 2);
+                }
             } else if (strcmp(arg, "null") == 0) {
                 action.flags |= CLIENTACT_NULSEP;
             } else {
@@ -806,6 +1115,15 @@ int main(int argc, char *argv[]) {
             case 'a':
                 action.action = LIST;
                 break;
+            case 'S':
+                action.action = LIST;
+                action.since = getarg(&opts, 0);
+                if (! action.since) {
+                    fprintf(stderr, "Missing required argument for '-%c'\n",
+                            opt);
+                    usage(0, 2);
+                }
+                break;
             case '0':
                 action.flags |= CLIENTACT_NULSEP;
                 break;
@@ -844,6 +1162,17 @@ int main(int argc, char *argv[]) {
         }
     }
     if (! conffile) conffile = DEFAULT_CONFFILE;
+    /* Go into background and fork the spawn helper (which is dropped again
+     * if the configuration does not ask for it) before the configuration
+     * is loaded, so that the helper's address space stays small */
+    if (server) {
+        if (background) {
+            readyfd = daemonize();
+            if (readyfd == -1) die("Failed to go into background");
+        }
+        spawner = spawner_start((background) ? "/" : NULL);
+        if (spawner == -1) spawnerr = errno;
+    }
     /* Create configuration */
     config = create_config(conffile);
     if (! config) die("Failed to load configuration");
@@ -853,7 +1182,16 @@ int main(int argc, char *argv[]) {
         /* Prepare logging */
         initlog(logfp, (syslogopts.facility == -2) ? NULL : &syslogopts,
                 logilevel);
-        ret = server_main(config, background, pidfile, args);
+        /* Hand the spawner over, if it is to be used */
+        if (! config->spawnhelper) {
+            if (spawner != -1) close(spawner);
+        } else if (spawner == -1) {
+            errno = spawnerr;
+            logerr(ERROR, "Could not start spawn helper");
+        } else {
+            config->spawner = spawner;
+        }
+        ret = server_main(config, readyfd, pidfile, args);
     } else {
         ret = client_main(config, action, args);
     }
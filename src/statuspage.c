@@ -0,0 +1,144 @@
+/* procmgr -- init-like process manager
+ * https://github.com/CylonicRaider/procmgr */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "config.h"
+#include "statuspage.h"
+#include "util.h"
+
+/* Static functions */
+static int grow_page(struct statuspage *page, int capacity);
+static void fill_record(struct statusrec *rec, struct program *prog);
+
+/* Create the status page file at path and map it into memory */
+struct statuspage *statuspage_open(char *path) {
+    struct statuspage *ret = calloc(1, sizeof(struct statuspage));
+    if (! ret) return NULL;
+    ret->fd = -1;
+    ret->path = strdup(path);
+    if (! ret->path) goto error;
+    /* Readers may still have the old file mapped; leave it to them */
+    if (unlink(path) == -1 && errno != ENOENT) goto error;
+    ret->fd = open(path, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+    if (ret->fd == -1) goto error;
+    if (grow_page(ret, STATUSPAGE_CAPACITY) == -1) goto error;
+    ret->header->magic = STATUSPAGE_MAGIC;
+    ret->header->version = STATUSPAGE_VERSION;
+    ret->header->hdrsize = sizeof(struct statushdr);
+    ret->header->recsize = sizeof(struct statusrec);
+    ret->header->pid = getpid();
+    return ret;
+    error:
+        statuspage_close(ret, ret->fd != -1);
+        return NULL;
+}
+
+/* Publish the current state of the programs to the page */
+int statuspage_update(struct statuspage *page, struct config *config) {
+    struct statushdr *hdr = page->header;
+    struct program *prog;
+    unsigned long long gen;
+    int count = 0, ret = 0;
+    __atomic_store_n(&hdr->heartbeat, hdr->heartbeat + 1, __ATOMIC_RELAXED);
+    /* The records only need to be rebuilt if the state of the programs
+     * has changed since they were last published completely */
+    gen = config_track(config);
+    if (gen == page->generation) return 0;
+    for (prog = config->programs; prog; prog = prog->next) count++;
+    if (count > page->capacity) {
+        int capacity = page->capacity;
+        while (capacity < count) capacity *= 2;
+        /* If that fails, what fits is published */
+        if (grow_page(page, capacity) == -1) ret = -1;
+        hdr = page->header;
+    }
+    /* Prepare the records and compare them to the published ones */
+    count = 0;
+    for (prog = config->programs; prog && count < page->capacity;
+         prog = prog->next)
+        fill_record(&page->shadow[count++], prog);
+    if (! ret) page->generation = gen;
+    if (count == hdr->count && memcmp(page->shadow, page->records,
+            count * sizeof(struct statusrec)) == 0)
+        return ret;
+    /* Write them under the sequence lock */
+    __atomic_store_n(&hdr->seq, hdr->seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    memcpy(page->records, page->shadow, count * sizeof(struct statusrec));
+    hdr->count = count;
+    hdr->updated = timestamp();
+    __atomic_store_n(&hdr->seq, hdr->seq + 1, __ATOMIC_RELEASE);
+    return ret;
+}
+
+/* Unmap the page and free the structure */
+void statuspage_close(struct statuspage *page, int remove) {
+    if (page->header)
+        munmap(page->header, sizeof(struct statushdr) +
+               page->capacity * sizeof(struct statusrec));
+    if (page->fd != -1) close(page->fd);
+    if (remove && page->path) {
+        int en = errno;
+        unlink(page->path);
+        errno = en;
+    }
+    free(page->shadow);
+    free(page->path);
+    free(page);
+}
+
+/* Enlarge the file and the shadow records to hold capacity records */
+int grow_page(struct statuspage *page, int capacity) {
+    size_t oldsize = sizeof(struct statushdr) +
+        page->capacity * sizeof(struct statusrec);
+    size_t size = sizeof(struct statushdr) +
+        capacity * sizeof(struct statusrec);
+    struct statusrec *shadow;
+    void *map;
+    shadow = realloc(page->shadow, capacity * sizeof(struct statusrec));
+    if (! shadow) return -1;
+    page->shadow = shadow;
+    if (ftruncate(page->fd, size) == -1) return -1;
+    if (page->header) {
+        map = mremap(page->header, oldsize, size, MREMAP_MAYMOVE);
+    } else {
+        map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                   page->fd, 0);
+    }
+    if (map == MAP_FAILED) return -1;
+    page->header = map;
+    page->records = (struct statusrec *) (page->header + 1);
+    page->capacity = capacity;
+    page->header->capacity = capacity;
+    return 0;
+}
+
+/* Describe the given program in a status record */
+void fill_record(struct statusrec *rec, struct program *prog) {
+    memset(rec, 0, sizeof(*rec));
+    strncpy(rec->name, prog->name, STATUSPAGE_NAMELEN - 1);
+    if (prog->pid != -1) {
+        rec->state = (prog->flags & PROG_STARTING) ? STATUSPAGE_STARTING :
+            STATUSPAGE_RUNNING;
+    } else if (prog->flags & PROG_SPAWNING) {
+        rec->state = STATUSPAGE_STARTING;
+    } else if (prog->flags & PROG_QUEUED) {
+        rec->state = STATUSPAGE_QUEUED;
+    } else if (prog->flags & PROG_QUARANTINED) {
+        rec->state = STATUSPAGE_QUARANTINED;
+    } else {
+        rec->state = STATUSPAGE_STOPPED;
+    }
+    rec->pid = prog->pid;
+    rec->started = prog->started;
+    rec->exited = prog->exited;
+    rec->exitcode = prog->exitcode;
+    rec->restarts = prog->restartcount;
+}
@@ -3,6 +3,7 @@
 
 #include <math.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
@@ -21,11 +22,38 @@ double timestamp() {
 
 /* Fork into background */
 int daemonize() {
-    int pid = fork();
-    if (pid == -1) return -1;
-    if (pid != 0) _exit(0);
-    if (setsid() == -1) return -1;
-    return chdir("/");
+    int fds[2], pid, res;
+    unsigned char status;
+    if (pipe(fds) == -1) return -1;
+    pid = fork();
+    if (pid == -1) goto error;
+    if (pid != 0) {
+        /* Exit with the status the child reports, or failure if it exits
+         * before reporting one */
+        close(fds[1]);
+        while ((res = read(fds[0], &status, 1)) == -1 && errno == EINTR);
+        _exit((res == 1) ? status : 1);
+    }
+    close(fds[0]);
+    if (fcntl(fds[1], F_SETFD, FD_CLOEXEC) == -1 || setsid() == -1) {
+        close(fds[1]);
+        return -1;
+    }
+    return fds[1];
+    error:
+        close(fds[0]);
+        close(fds[1]);
+        return -1;
+}
+
+/* Report the given status to the parent left behind by daemonize() */
+int daemonize_done(int fd, int status) {
+    unsigned char code = status;
+    int ret = 0;
+    if (write(fd, &code, 1) != 1) ret = -1;
+    close(fd);
+    if (chdir("/") == -1) ret = -1;
+    return ret;
 }
 
 /* Parse an integer, optionally interpreting certain keywords */
@@ -48,3 +76,29 @@ int parse_int(int *ret, char *data, int keywords) {
     *ret = temp;
     return 1;
 }
+
+/* Parse a floating-point number */
+int parse_double(double *ret, char *data) {
+    char *end;
+    double temp;
+    errno = 0;
+    temp = strtod(data, &end);
+    if (errno) return 0;
+    if (end == data || *end || isnan(temp)) {
+        errno = EINVAL;
+        return 0;
+    }
+    *ret = temp;
+    return 1;
+}
+
+/* Concatenate two strings into a newly allocated one */
+char *concat(char *s1, char *s2) {
+    int l1 = strlen(s1), l2 = strlen(s2);
+    char *r = malloc(l1 + l2 + 1);
+    if (! r) return NULL;
+    memcpy(r, s1, l1);
+    memcpy(r + l1, s2, l2);
+    r[l1 + l2] = '\0';
+    return r;
+}